@@ -0,0 +1,65 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.api;
+
+/**
+ * Reason a lookup failed.
+ *
+ * There is a single, shared, instance for each of the reasons, see {@link #forReason(Reason)}.
+ * These don't capture a stack trace, so that failing many lookups at once, i.e. during an outage
+ * of the upstream resolvers, is no more expensive than completing them.
+ */
+public class LookupFailedException extends RuntimeException {
+    private static final long serialVersionUID = 1L;
+
+    public enum Reason {
+        TIMEOUT("Query timed out."),
+        REJECTED("Too many outstanding queries on context."),
+        INVALID_ADDRESS("Invalid IP address."),
+        INVALID_CONTEXT("Invalid context id."),
+        RESOLVER_ERROR("Resolver error."),
+        INTERNAL_ERROR("Internal error.");
+
+        private final String message;
+
+        Reason(String message) {
+            this.message = message;
+        }
+    }
+
+    private static final LookupFailedException[] INSTANCES = new LookupFailedException[Reason.values().length];
+    static {
+        for (Reason reason : Reason.values()) {
+            INSTANCES[reason.ordinal()] = new LookupFailedException(reason);
+        }
+    }
+
+    private final Reason reason;
+
+    private LookupFailedException(Reason reason) {
+        super(reason.message, null, false, false);
+        this.reason = reason;
+    }
+
+    public static LookupFailedException forReason(Reason reason) {
+        return INSTANCES[reason.ordinal()];
+    }
+
+    public Reason getReason() {
+        return reason;
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.api;
+
+import java.net.InetAddress;
+import java.util.Objects;
+
+/**
+ * Decides how lookups for the addresses in a prefix are handled, before they are resolved.
+ * When several rules contain an address, the one with the longest prefix applies.
+ */
+public final class PrefixRule {
+
+    /**
+     * Keep in sync with enum ub4j_rule_action in ruletable.h.
+     */
+    public enum Action {
+        /** Answer the lookups with no hostname, without querying. */
+        ANSWER_EMPTY,
+        /** Resolve the lookups with another context, i.e. one that uses an internal resolver. */
+        ROUTE,
+        /** Resolve the lookups as usual, i.e. to exempt part of a wider prefix. */
+        RESOLVE
+    }
+
+    private final InetAddress address;
+    private final int prefixLength;
+    private final Action action;
+    private final int contextId;
+
+    private PrefixRule(InetAddress address, int prefixLength, Action action, int contextId) {
+        if (prefixLength < 0 || prefixLength > address.getAddress().length * 8) {
+            throw new IllegalArgumentException("Invalid prefix length for " + address.getHostAddress() + ": " + prefixLength);
+        }
+        this.address = address;
+        this.prefixLength = prefixLength;
+        this.action = action;
+        this.contextId = contextId;
+    }
+
+    public static PrefixRule answerEmpty(InetAddress address, int prefixLength) {
+        return new PrefixRule(address, prefixLength, Action.ANSWER_EMPTY, 0);
+    }
+
+    public static PrefixRule routeTo(InetAddress address, int prefixLength, Unbound4jContext ctx) {
+        return new PrefixRule(address, prefixLength, Action.ROUTE, ctx.getId());
+    }
+
+    public static PrefixRule resolve(InetAddress address, int prefixLength) {
+        return new PrefixRule(address, prefixLength, Action.RESOLVE, 0);
+    }
+
+    public InetAddress getAddress() {
+        return address;
+    }
+
+    public int getPrefixLength() {
+        return prefixLength;
+    }
+
+    public Action getAction() {
+        return action;
+    }
+
+    /**
+     * @return the id of the context the lookups are routed to, or 0 unless the action is {@link Action#ROUTE}
+     */
+    public int getContextId() {
+        return contextId;
+    }
+
+    @Override
+    public boolean equals(Object o) {
+        if (this == o) return true;
+        if (!(o instanceof PrefixRule)) return false;
+        PrefixRule that = (PrefixRule) o;
+        return prefixLength == that.prefixLength &&
+                contextId == that.contextId &&
+                action == that.action &&
+                Objects.equals(address, that.address);
+    }
+
+    @Override
+    public int hashCode() {
+        return Objects.hash(address, prefixLength, action, contextId);
+    }
+
+    @Override
+    public String toString() {
+        return "PrefixRule{" +
+                "prefix=" + address.getHostAddress() + "/" + prefixLength +
+                ", action=" + action +
+                ", contextId=" + contextId +
+                '}';
+    }
+}
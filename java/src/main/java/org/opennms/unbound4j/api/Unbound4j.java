@@ -17,6 +17,8 @@
 package org.opennms.unbound4j.api;
 
 import java.net.InetAddress;
+import java.util.Collection;
+import java.util.List;
 import java.util.Optional;
 import java.util.concurrent.CompletableFuture;
 
@@ -26,4 +28,33 @@ public interface Unbound4j {
 
     CompletableFuture<Optional<String>> reverseLookup(Unbound4jContext ctx, final InetAddress addr);
 
+    /**
+     * Looks up an IPv4 address given as an int in network byte order, i.e. 192.0.2.1 is 0xC0000201.
+     */
+    CompletableFuture<Optional<String>> reverseLookupV4(Unbound4jContext ctx, int addr);
+
+    /**
+     * Looks up an IPv6 address given as two longs in network byte order, holding the first and last 8 bytes
+     * of the address respectively.
+     */
+    CompletableFuture<Optional<String>> reverseLookupV6(Unbound4jContext ctx, long addrHi, long addrLo);
+
+    /**
+     * Looks up all of the given addresses, crossing into the native library once for the whole batch.
+     *
+     * @return a future for each of the addresses, in iteration order
+     */
+    List<CompletableFuture<Optional<String>>> reverseLookupAll(Unbound4jContext ctx, Collection<InetAddress> addrs);
+
+    Unbound4jStats getStats(Unbound4jContext ctx);
+
+    /**
+     * Replaces the overrides of the context with those of the given file, generated by unbound4j_hostsgen,
+     * or removes them if the file is null. Lookups made while the file is being swapped see either the
+     * old or the new overrides.
+     *
+     * @see Unbound4jConfig.Builder#withOverridesFile(String)
+     */
+    void setOverridesFile(Unbound4jContext ctx, String file);
+
 }
@@ -16,18 +16,74 @@
 
 package org.opennms.unbound4j.api;
 
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
 import java.util.Objects;
+import java.util.concurrent.Executor;
 import java.util.concurrent.TimeUnit;
 
 public class Unbound4jConfig {
     private final boolean useSystemResolver;
-    private final int requestTimeoutSeconds;
+    private final int requestTimeoutMillis;
     private final String unboundConfig;
+    private final int maxInflightQueries;
+    private final int shards;
+    private final int cacheCapacity;
+    private final int cacheMaxTtlSeconds;
+    private final int cacheNxdomainTtlSeconds;
+    private final int cacheServfailTtlSeconds;
+    private final int cacheTimeoutTtlSeconds;
+    private final int cacheRefreshPercent;
+    private final int cacheRefreshMinHits;
+    private final int cacheRefreshMaxPerSecond;
+    private final int cacheMaxStaleSeconds;
+    private final int negativePrefixCacheCapacity;
+    private final boolean useSpecialPurposeRules;
+    private final List<PrefixRule> prefixRules;
+    private final String overridesFile;
+    private final String cacheSnapshotFile;
+    private final int cacheSnapshotIntervalSeconds;
+    private final String sharedCacheName;
+    private final int sharedCacheCapacity;
+    private final int admissionMinHits;
+    private final int admissionWindowSeconds;
+    private final int admissionSketchWidth;
+    private final long memoryBudgetBytes;
+    private final boolean useCompletionRing;
+    private final Executor completionExecutor;
+    private final int completionThreads;
 
     private Unbound4jConfig(Builder builder) {
         this.useSystemResolver = builder.useSystemResolver;
-        this.requestTimeoutSeconds = builder.requestTimeoutSeconds;
+        this.requestTimeoutMillis = builder.requestTimeoutMillis;
         this.unboundConfig = builder.unboundConfig;
+        this.maxInflightQueries = builder.maxInflightQueries;
+        this.shards = builder.shards;
+        this.cacheCapacity = builder.cacheCapacity;
+        this.cacheMaxTtlSeconds = builder.cacheMaxTtlSeconds;
+        this.cacheNxdomainTtlSeconds = builder.cacheNxdomainTtlSeconds;
+        this.cacheServfailTtlSeconds = builder.cacheServfailTtlSeconds;
+        this.cacheTimeoutTtlSeconds = builder.cacheTimeoutTtlSeconds;
+        this.cacheRefreshPercent = builder.cacheRefreshPercent;
+        this.cacheRefreshMinHits = builder.cacheRefreshMinHits;
+        this.cacheRefreshMaxPerSecond = builder.cacheRefreshMaxPerSecond;
+        this.cacheMaxStaleSeconds = builder.cacheMaxStaleSeconds;
+        this.negativePrefixCacheCapacity = builder.negativePrefixCacheCapacity;
+        this.useSpecialPurposeRules = builder.useSpecialPurposeRules;
+        this.prefixRules = Collections.unmodifiableList(new ArrayList<>(builder.prefixRules));
+        this.overridesFile = builder.overridesFile;
+        this.cacheSnapshotFile = builder.cacheSnapshotFile;
+        this.cacheSnapshotIntervalSeconds = builder.cacheSnapshotIntervalSeconds;
+        this.sharedCacheName = builder.sharedCacheName;
+        this.sharedCacheCapacity = builder.sharedCacheCapacity;
+        this.admissionMinHits = builder.admissionMinHits;
+        this.admissionWindowSeconds = builder.admissionWindowSeconds;
+        this.admissionSketchWidth = builder.admissionSketchWidth;
+        this.memoryBudgetBytes = builder.memoryBudgetBytes;
+        this.useCompletionRing = builder.useCompletionRing;
+        this.completionExecutor = builder.completionExecutor;
+        this.completionThreads = builder.completionThreads;
     }
 
     public static Builder newBuilder() {
@@ -36,8 +92,34 @@ public class Unbound4jConfig {
 
     public static final class Builder {
         private boolean useSystemResolver = true;
-        private int requestTimeoutSeconds = 5;
+        private int requestTimeoutMillis = 5000;
         private String unboundConfig;
+        private int maxInflightQueries = 100000;
+        private int shards = 1;
+        private int cacheCapacity = 0;
+        private int cacheMaxTtlSeconds = (int)TimeUnit.DAYS.toSeconds(1);
+        private int cacheNxdomainTtlSeconds = (int)TimeUnit.MINUTES.toSeconds(15);
+        private int cacheServfailTtlSeconds = (int)TimeUnit.MINUTES.toSeconds(1);
+        private int cacheTimeoutTtlSeconds = (int)TimeUnit.MINUTES.toSeconds(1);
+        private int cacheRefreshPercent = 0;
+        private int cacheRefreshMinHits = 2;
+        private int cacheRefreshMaxPerSecond = 100;
+        private int cacheMaxStaleSeconds = 0;
+        private int negativePrefixCacheCapacity = 0;
+        private boolean useSpecialPurposeRules = false;
+        private final List<PrefixRule> prefixRules = new ArrayList<>();
+        private String overridesFile;
+        private String cacheSnapshotFile;
+        private int cacheSnapshotIntervalSeconds = (int)TimeUnit.MINUTES.toSeconds(5);
+        private String sharedCacheName;
+        private int sharedCacheCapacity;
+        private int admissionMinHits = 0;
+        private int admissionWindowSeconds = (int)TimeUnit.MINUTES.toSeconds(1);
+        private int admissionSketchWidth = 1 << 20;
+        private long memoryBudgetBytes = 0;
+        private boolean useCompletionRing = false;
+        private Executor completionExecutor;
+        private int completionThreads = 0;
 
         public Builder useSystemResolver(boolean useSystemResolver) {
             this.useSystemResolver = useSystemResolver;
@@ -49,8 +131,247 @@ public class Unbound4jConfig {
             return this;
         }
 
+        /**
+         * Sets the maximum amount of time to wait for an answer. Timeouts are enforced with millisecond resolution.
+         */
         public Builder withRequestTimeout(long duration, TimeUnit unit) {
-            requestTimeoutSeconds = (int)unit.toSeconds(duration);
+            requestTimeoutMillis = (int)unit.toMillis(duration);
+            return this;
+        }
+
+        /**
+         * Sets the maximum number of queries that can be outstanding on the context at any given time.
+         * Space for tracking these is allocated up front when the context is created.
+         */
+        public Builder withMaxInflightQueries(int maxInflightQueries) {
+            this.maxInflightQueries = maxInflightQueries;
+            return this;
+        }
+
+        /**
+         * Sets the number of Unbound contexts, each with their own processing thread, used to resolve
+         * lookups made against the context. Any given address is always resolved by the same shard.
+         */
+        public Builder withShards(int shards) {
+            this.shards = shards;
+            return this;
+        }
+
+        /**
+         * Sets the maximum number of answers cached by the context. Cached answers are kept for the TTL
+         * of the record and are returned immediately, without involving the processing threads.
+         * The cache is disabled when set to 0, which is the default.
+         */
+        public Builder withCacheCapacity(int cacheCapacity) {
+            this.cacheCapacity = cacheCapacity;
+            return this;
+        }
+
+        /**
+         * Sets the maximum amount of time an answer can be cached for, regardless of its TTL.
+         */
+        public Builder withCacheMaxTtl(long duration, TimeUnit unit) {
+            cacheMaxTtlSeconds = (int)unit.toSeconds(duration);
+            return this;
+        }
+
+        /**
+         * Sets how long to cache the absence of a PTR record (NXDOMAIN or no data) for. The TTL
+         * given by the SOA record of the zone is used instead when it is lower. Set to 0 to disable.
+         */
+        public Builder withCacheNxdomainTtl(long duration, TimeUnit unit) {
+            cacheNxdomainTtlSeconds = (int)unit.toSeconds(duration);
+            return this;
+        }
+
+        /**
+         * Sets how long to cache SERVFAIL, and other failed responses, for. Set to 0 to disable.
+         */
+        public Builder withCacheServfailTtl(long duration, TimeUnit unit) {
+            cacheServfailTtlSeconds = (int)unit.toSeconds(duration);
+            return this;
+        }
+
+        /**
+         * Sets how long to cache lookups that timed out for. Set to 0 to disable.
+         */
+        public Builder withCacheTimeoutTtl(long duration, TimeUnit unit) {
+            cacheTimeoutTtlSeconds = (int)unit.toSeconds(duration);
+            return this;
+        }
+
+        /**
+         * Resolves hot cache entries again in the background once the given percentage of their TTL has elapsed,
+         * so that they are replaced before they expire instead of missing. An entry is hot once it was hit at least
+         * minHits times since it was stored. Entries that come back with a failure are kept until they expire.
+         * Disabled when set to 0, which is the default.
+         */
+        public Builder withCacheRefreshAhead(int percentOfTtl, int minHits) {
+            this.cacheRefreshPercent = percentOfTtl;
+            this.cacheRefreshMinHits = minHits;
+            return this;
+        }
+
+        /**
+         * Sets the maximum number of background refreshes made per second, see {@link #withCacheRefreshAhead(int, int)}.
+         * Entries over the budget are refreshed on a later hit, if they haven't expired by then. Defaults to 100.
+         */
+        public Builder withCacheRefreshBudget(int maxPerSecond) {
+            this.cacheRefreshMaxPerSecond = maxPerSecond;
+            return this;
+        }
+
+        /**
+         * Keeps hostnames, and the absence of one, in the cache for up to the given time past their expiry.
+         * Lookups that hit an expired entry are answered with it right away while the address is resolved
+         * again in the background, and keep being answered with it if that fails or times out, so that a
+         * resolver outage doesn't turn every expired entry into a timeout. Disabled when set to 0, which is
+         * the default.
+         */
+        public Builder withCacheServeStale(long maxStaleness, TimeUnit unit) {
+            cacheMaxStaleSeconds = (int)unit.toSeconds(maxStaleness);
+            return this;
+        }
+
+        /**
+         * Sets the maximum number of /24 (IPv4) and /48 (IPv6) prefixes remembered as having no reverse zone.
+         * When an address comes back NXDOMAIN from a zone above its prefix, the prefix's own reverse domain is
+         * queried, and if it doesn't exist either, lookups for any address in the prefix are answered without
+         * a query for as long as the NXDOMAIN TTL. The cache is disabled when set to 0, which is the default.
+         */
+        public Builder withNegativePrefixCacheCapacity(int negativePrefixCacheCapacity) {
+            this.negativePrefixCacheCapacity = negativePrefixCacheCapacity;
+            return this;
+        }
+
+        /**
+         * When enabled, lookups for the special-purpose ranges of RFC 6890 (private-use, loopback, link local,
+         * CGNAT, documentation, multicast, ...) are answered with no hostname without querying. Rules added with
+         * {@link #withPrefixRule(PrefixRule)} take precedence, i.e. to route the private ranges to a context
+         * that uses an internal resolver. Disabled by default.
+         */
+        public Builder useSpecialPurposeRules(boolean useSpecialPurposeRules) {
+            this.useSpecialPurposeRules = useSpecialPurposeRules;
+            return this;
+        }
+
+        /**
+         * Adds a rule for the lookups of the addresses in a prefix. A later rule replaces an earlier one for the same prefix.
+         */
+        public Builder withPrefixRule(PrefixRule prefixRule) {
+            prefixRules.add(Objects.requireNonNull(prefixRule));
+            return this;
+        }
+
+        /**
+         * Sets the file, generated by unbound4j_hostsgen, holding the hostnames of addresses that are answered
+         * without being looked up, i.e. an export from an IPAM system. The file is memory-mapped, and can be
+         * replaced at runtime with {@link Unbound4j#setOverridesFile(Unbound4jContext, String)}.
+         */
+        public Builder withOverridesFile(String overridesFile) {
+            this.overridesFile = overridesFile;
+            return this;
+        }
+
+        /**
+         * Sets the file the cache is saved to when the context is closed, and periodically while it's open,
+         * and loaded from when the context is created, so that a restart doesn't start with a cold cache.
+         * Entries that expired in the meantime are dropped. Only used when the cache is enabled.
+         */
+        public Builder withCacheSnapshotFile(String cacheSnapshotFile) {
+            this.cacheSnapshotFile = cacheSnapshotFile;
+            return this;
+        }
+
+        /**
+         * Sets how often the cache snapshot is written while the context is open. Defaults to 5 minutes,
+         * set to 0 to only write it when the context is closed.
+         */
+        public Builder withCacheSnapshotInterval(long duration, TimeUnit unit) {
+            cacheSnapshotIntervalSeconds = (int)unit.toSeconds(duration);
+            return this;
+        }
+
+        /**
+         * Shares a cache with every process on the host that uses the same name, i.e. "/unbound4j", so that
+         * an answer obtained by one JVM serves all of them. The cache lives in a POSIX shared memory segment
+         * that is created with room for the given number of entries by the first process to attach to it, and
+         * left in place when the processes exit. It is checked after the cache of the context, which can be
+         * disabled to keep the memory used by each process from growing with the size of the cache.
+         * The capacity must be positive. The segment is created with mode 0660, so JVMs running as different
+         * users can only share it if they're in the group of the user that created it.
+         */
+        public Builder withSharedCache(String sharedCacheName, int sharedCacheCapacity) {
+            this.sharedCacheName = sharedCacheName;
+            this.sharedCacheCapacity = sharedCacheCapacity;
+            return this;
+        }
+
+        /**
+         * Only resolves addresses that were looked up at least minHits times within about the given window,
+         * to keep the addresses of port scans and spoofed floods, which are seen once and never again, from
+         * costing a query and a cache entry each. Other lookups complete right away without a hostname.
+         * Lookups are counted in a sketch of fixed size, see {@link #withAdmissionSketchWidth(int)}, whose
+         * counts are halved at the end of every window. Disabled when set to 0, which is the default.
+         */
+        public Builder withAdmissionFilter(int minHits, long window, TimeUnit unit) {
+            this.admissionMinHits = minHits;
+            this.admissionWindowSeconds = (int)unit.toSeconds(window);
+            return this;
+        }
+
+        /**
+         * Sets the number of counters in each of the 4 rows of the admission filter's sketch, at one byte each.
+         * It should be in the order of the number of distinct addresses seen in a window, or more addresses
+         * will be let through than should be. Defaults to 1M.
+         */
+        public Builder withAdmissionSketchWidth(int admissionSketchWidth) {
+            this.admissionSketchWidth = admissionSketchWidth;
+            return this;
+        }
+
+        /**
+         * Bounds the native memory held by the context: the tracking of the in-flight queries, the caches,
+         * the admission filter and the hostnames too long to be stored in their cache entry. Everything but
+         * the hostnames is allocated up front, when the context is created, which fails if that doesn't fit.
+         * The rest of the budget goes to the hostnames, and cache entries are evicted, or left out, to stay
+         * within it. Lookups beyond the maximum number of in-flight queries are rejected as before.
+         * The memory held by Unbound itself isn't included. Unbounded when set to 0, which is the default.
+         *
+         * @see Unbound4jStats#getInflightBytes()
+         */
+        public Builder withMemoryBudget(long memoryBudgetBytes) {
+            this.memoryBudgetBytes = memoryBudgetBytes;
+            return this;
+        }
+
+        /**
+         * When enabled, results are written to a ring buffer shared with Java and a single poller
+         * thread completes the futures in bulk, instead of calling back into the JVM for every result.
+         * The futures are then completed on the poller thread. Disabled by default.
+         */
+        public Builder useCompletionRing(boolean useCompletionRing) {
+            this.useCompletionRing = useCompletionRing;
+            return this;
+        }
+
+        /**
+         * Sets the executor the futures returned by the lookups are completed on. By default, they are completed
+         * on the thread that delivers the result, which delays other results for as long as the dependent
+         * actions run.
+         */
+        public Builder withCompletionExecutor(Executor completionExecutor) {
+            this.completionExecutor = completionExecutor;
+            return this;
+        }
+
+        /**
+         * Sets the number of threads in a pool, owned by the context, that the futures returned by the lookups
+         * are completed on. Ignored when an executor is set with {@link #withCompletionExecutor(Executor)}.
+         * Disabled when set to 0, which is the default.
+         */
+        public Builder withCompletionThreads(int completionThreads) {
+            this.completionThreads = completionThreads;
             return this;
         }
 
@@ -63,35 +384,200 @@ public class Unbound4jConfig {
         return useSystemResolver;
     }
 
+    public int getRequestTimeoutMillis() {
+        return requestTimeoutMillis;
+    }
+
     public int getRequestTimeoutSeconds() {
-        return requestTimeoutSeconds;
+        return (int)TimeUnit.MILLISECONDS.toSeconds(requestTimeoutMillis);
     }
 
     public String getUnboundConfig() {
         return unboundConfig;
     }
 
+    public int getMaxInflightQueries() {
+        return maxInflightQueries;
+    }
+
+    public int getShards() {
+        return shards;
+    }
+
+    public int getCacheCapacity() {
+        return cacheCapacity;
+    }
+
+    public int getCacheMaxTtlSeconds() {
+        return cacheMaxTtlSeconds;
+    }
+
+    public int getCacheNxdomainTtlSeconds() {
+        return cacheNxdomainTtlSeconds;
+    }
+
+    public int getCacheServfailTtlSeconds() {
+        return cacheServfailTtlSeconds;
+    }
+
+    public int getCacheTimeoutTtlSeconds() {
+        return cacheTimeoutTtlSeconds;
+    }
+
+    public int getCacheRefreshPercent() {
+        return cacheRefreshPercent;
+    }
+
+    public int getCacheRefreshMinHits() {
+        return cacheRefreshMinHits;
+    }
+
+    public int getCacheRefreshMaxPerSecond() {
+        return cacheRefreshMaxPerSecond;
+    }
+
+    public int getCacheMaxStaleSeconds() {
+        return cacheMaxStaleSeconds;
+    }
+
+    public int getNegativePrefixCacheCapacity() {
+        return negativePrefixCacheCapacity;
+    }
+
+    public boolean isUseSpecialPurposeRules() {
+        return useSpecialPurposeRules;
+    }
+
+    public List<PrefixRule> getPrefixRules() {
+        return prefixRules;
+    }
+
+    public String getOverridesFile() {
+        return overridesFile;
+    }
+
+    public String getCacheSnapshotFile() {
+        return cacheSnapshotFile;
+    }
+
+    public int getCacheSnapshotIntervalSeconds() {
+        return cacheSnapshotIntervalSeconds;
+    }
+
+    public String getSharedCacheName() {
+        return sharedCacheName;
+    }
+
+    public int getSharedCacheCapacity() {
+        return sharedCacheCapacity;
+    }
+
+    public int getAdmissionMinHits() {
+        return admissionMinHits;
+    }
+
+    public int getAdmissionWindowSeconds() {
+        return admissionWindowSeconds;
+    }
+
+    public int getAdmissionSketchWidth() {
+        return admissionSketchWidth;
+    }
+
+    public long getMemoryBudgetBytes() {
+        return memoryBudgetBytes;
+    }
+
+    public boolean isUseCompletionRing() {
+        return useCompletionRing;
+    }
+
+    public Executor getCompletionExecutor() {
+        return completionExecutor;
+    }
+
+    public int getCompletionThreads() {
+        return completionThreads;
+    }
+
     @Override
     public boolean equals(Object o) {
         if (this == o) return true;
         if (!(o instanceof Unbound4jConfig)) return false;
         Unbound4jConfig that = (Unbound4jConfig) o;
         return useSystemResolver == that.useSystemResolver &&
-                requestTimeoutSeconds == that.requestTimeoutSeconds &&
+                requestTimeoutMillis == that.requestTimeoutMillis &&
+                maxInflightQueries == that.maxInflightQueries &&
+                shards == that.shards &&
+                cacheCapacity == that.cacheCapacity &&
+                cacheMaxTtlSeconds == that.cacheMaxTtlSeconds &&
+                cacheNxdomainTtlSeconds == that.cacheNxdomainTtlSeconds &&
+                cacheServfailTtlSeconds == that.cacheServfailTtlSeconds &&
+                cacheTimeoutTtlSeconds == that.cacheTimeoutTtlSeconds &&
+                cacheRefreshPercent == that.cacheRefreshPercent &&
+                cacheRefreshMinHits == that.cacheRefreshMinHits &&
+                cacheRefreshMaxPerSecond == that.cacheRefreshMaxPerSecond &&
+                cacheMaxStaleSeconds == that.cacheMaxStaleSeconds &&
+                negativePrefixCacheCapacity == that.negativePrefixCacheCapacity &&
+                useSpecialPurposeRules == that.useSpecialPurposeRules &&
+                cacheSnapshotIntervalSeconds == that.cacheSnapshotIntervalSeconds &&
+                sharedCacheCapacity == that.sharedCacheCapacity &&
+                admissionMinHits == that.admissionMinHits &&
+                admissionWindowSeconds == that.admissionWindowSeconds &&
+                admissionSketchWidth == that.admissionSketchWidth &&
+                memoryBudgetBytes == that.memoryBudgetBytes &&
+                useCompletionRing == that.useCompletionRing &&
+                completionThreads == that.completionThreads &&
+                Objects.equals(prefixRules, that.prefixRules) &&
+                Objects.equals(overridesFile, that.overridesFile) &&
+                Objects.equals(cacheSnapshotFile, that.cacheSnapshotFile) &&
+                Objects.equals(sharedCacheName, that.sharedCacheName) &&
+                Objects.equals(completionExecutor, that.completionExecutor) &&
                 Objects.equals(unboundConfig, that.unboundConfig);
     }
 
     @Override
     public int hashCode() {
-        return Objects.hash(useSystemResolver, requestTimeoutSeconds, unboundConfig);
+        return Objects.hash(useSystemResolver, requestTimeoutMillis, unboundConfig, maxInflightQueries, shards,
+                cacheCapacity, cacheMaxTtlSeconds, cacheNxdomainTtlSeconds, cacheServfailTtlSeconds, cacheTimeoutTtlSeconds,
+                cacheRefreshPercent, cacheRefreshMinHits, cacheRefreshMaxPerSecond, cacheMaxStaleSeconds,
+                negativePrefixCacheCapacity, useSpecialPurposeRules, prefixRules, overridesFile,
+                cacheSnapshotFile, cacheSnapshotIntervalSeconds, sharedCacheName, sharedCacheCapacity,
+                admissionMinHits, admissionWindowSeconds, admissionSketchWidth, memoryBudgetBytes, useCompletionRing, completionExecutor, completionThreads);
     }
 
     @Override
     public String toString() {
         return "Unbound4jConfig{" +
                 "useSystemResolver=" + useSystemResolver +
-                ", requestTimeoutSeconds=" + requestTimeoutSeconds +
+                ", requestTimeoutMillis=" + requestTimeoutMillis +
                 ", unboundConfig='" + unboundConfig + '\'' +
+                ", maxInflightQueries=" + maxInflightQueries +
+                ", shards=" + shards +
+                ", cacheCapacity=" + cacheCapacity +
+                ", cacheMaxTtlSeconds=" + cacheMaxTtlSeconds +
+                ", cacheNxdomainTtlSeconds=" + cacheNxdomainTtlSeconds +
+                ", cacheServfailTtlSeconds=" + cacheServfailTtlSeconds +
+                ", cacheTimeoutTtlSeconds=" + cacheTimeoutTtlSeconds +
+                ", cacheRefreshPercent=" + cacheRefreshPercent +
+                ", cacheRefreshMinHits=" + cacheRefreshMinHits +
+                ", cacheRefreshMaxPerSecond=" + cacheRefreshMaxPerSecond +
+                ", cacheMaxStaleSeconds=" + cacheMaxStaleSeconds +
+                ", negativePrefixCacheCapacity=" + negativePrefixCacheCapacity +
+                ", useSpecialPurposeRules=" + useSpecialPurposeRules +
+                ", prefixRules=" + prefixRules +
+                ", overridesFile='" + overridesFile + '\'' +
+                ", cacheSnapshotFile='" + cacheSnapshotFile + '\'' +
+                ", cacheSnapshotIntervalSeconds=" + cacheSnapshotIntervalSeconds +
+                ", sharedCacheName='" + sharedCacheName + '\'' +
+                ", sharedCacheCapacity=" + sharedCacheCapacity +
+                ", admissionMinHits=" + admissionMinHits +
+                ", admissionWindowSeconds=" + admissionWindowSeconds +
+                ", admissionSketchWidth=" + admissionSketchWidth +
+                ", memoryBudgetBytes=" + memoryBudgetBytes +
+                ", useCompletionRing=" + useCompletionRing +
+                ", completionExecutor=" + completionExecutor +
+                ", completionThreads=" + completionThreads +
                 '}';
     }
 }
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.api;
+
+/**
+ * Counters for the lookups made against a context.
+ */
+public class Unbound4jStats {
+    private final long lookups;
+    private final long cacheHits;
+    private final long coalesced;
+    private final long queriesSent;
+    private final long rejected;
+    private final long timeouts;
+    private final long hostnameAllocations;
+    private final long shortCircuited;
+    private final long overrideHits;
+    private final long sharedCacheHits;
+    private final long refreshes;
+    private final long staleHits;
+    private final long notAdmitted;
+    private final long inflightBytes;
+    private final long cacheBytes;
+    private final long hostnameBytes;
+    private final long otherBytes;
+
+    /**
+     * @param values the counters, in the order they are returned by the native library
+     */
+    public Unbound4jStats(long[] values) {
+        this.lookups = values[0];
+        this.cacheHits = values[1];
+        this.coalesced = values[2];
+        this.queriesSent = values[3];
+        this.rejected = values[4];
+        this.timeouts = values[5];
+        this.hostnameAllocations = values[6];
+        this.shortCircuited = values[7];
+        this.overrideHits = values[8];
+        this.sharedCacheHits = values[9];
+        this.refreshes = values[10];
+        this.staleHits = values[11];
+        this.notAdmitted = values[12];
+        this.inflightBytes = values[13];
+        this.cacheBytes = values[14];
+        this.hostnameBytes = values[15];
+        this.otherBytes = values[16];
+    }
+
+    public long getLookups() {
+        return lookups;
+    }
+
+    public long getCacheHits() {
+        return cacheHits;
+    }
+
+    /**
+     * Number of lookups that were attached to a query already in flight for the same address.
+     */
+    public long getCoalesced() {
+        return coalesced;
+    }
+
+    public long getQueriesSent() {
+        return queriesSent;
+    }
+
+    public long getRejected() {
+        return rejected;
+    }
+
+    public long getTimeouts() {
+        return timeouts;
+    }
+
+    /**
+     * Number of cached hostnames that were too long to be stored in their cache entry, and were copied
+     * to the native heap instead. Those are the only allocations made by the native library while handling
+     * lookups, everything else is allocated up front. The allocations made by Unbound itself, and the strings
+     * created to complete lookups through upcalls rather than the completion ring, aren't included.
+     */
+    public long getHostnameAllocations() {
+        return hostnameAllocations;
+    }
+
+    /**
+     * Number of lookups answered empty, or routed to another context, by a prefix rule.
+     */
+    public long getShortCircuited() {
+        return shortCircuited;
+    }
+
+    /**
+     * Number of lookups answered from the overrides file.
+     */
+    public long getOverrideHits() {
+        return overrideHits;
+    }
+
+    /**
+     * Number of lookups answered from the cache shared with the other processes on the host.
+     */
+    public long getSharedCacheHits() {
+        return sharedCacheHits;
+    }
+
+    /**
+     * Number of queries made to refresh hot cache entries before they expire.
+     */
+    public long getRefreshes() {
+        return refreshes;
+    }
+
+    /**
+     * Number of cache hits that were answered with an expired entry. These are included in the cache hits.
+     */
+    public long getStaleHits() {
+        return staleHits;
+    }
+
+    /**
+     * Number of lookups left unresolved by the admission filter.
+     */
+    public long getNotAdmitted() {
+        return notAdmitted;
+    }
+
+    /**
+     * Native memory used to track the in-flight queries, allocated up front.
+     */
+    public long getInflightBytes() {
+        return inflightBytes;
+    }
+
+    /**
+     * Native memory used by the entries of the cache, allocated up front.
+     */
+    public long getCacheBytes() {
+        return cacheBytes;
+    }
+
+    /**
+     * Native memory used by cached hostnames that are too long to be stored in their entry.
+     */
+    public long getHostnameBytes() {
+        return hostnameBytes;
+    }
+
+    /**
+     * Native memory used by the negative prefix cache and the admission filter, allocated up front.
+     */
+    public long getOtherBytes() {
+        return otherBytes;
+    }
+
+    @Override
+    public String toString() {
+        return "Unbound4jStats{" +
+                "lookups=" + lookups +
+                ", cacheHits=" + cacheHits +
+                ", coalesced=" + coalesced +
+                ", queriesSent=" + queriesSent +
+                ", rejected=" + rejected +
+                ", timeouts=" + timeouts +
+                ", hostnameAllocations=" + hostnameAllocations +
+                ", shortCircuited=" + shortCircuited +
+                ", overrideHits=" + overrideHits +
+                ", sharedCacheHits=" + sharedCacheHits +
+                ", refreshes=" + refreshes +
+                ", staleHits=" + staleHits +
+                ", notAdmitted=" + notAdmitted +
+                ", inflightBytes=" + inflightBytes +
+                ", cacheBytes=" + cacheBytes +
+                ", hostnameBytes=" + hostnameBytes +
+                ", otherBytes=" + otherBytes +
+                '}';
+    }
+}
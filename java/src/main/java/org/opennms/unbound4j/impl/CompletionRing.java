@@ -0,0 +1,165 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.impl;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.concurrent.CompletableFuture;
+
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+/**
+ * Completes lookups from the records written by the native code to a ring buffer that is shared
+ * with Java, instead of having the native code call back into the JVM for every result.
+ *
+ * A single poller thread drains the ring in bulk. See completionring.h for the layout of the records.
+ */
+public class CompletionRing {
+    private static final Logger LOG = LoggerFactory.getLogger(CompletionRing.class);
+
+    private static final int CAPACITY = Integer.getInteger("org.opennms.unbound4j.completionRingBytes", 4 * 1024 * 1024);
+    private static final int POLL_TIMEOUT_MS = 1000;
+
+    // Keep in sync with completionring.h
+    private static final int STATUS_PADDING = -1;
+    private static final int HEADER_LEN = 24;
+
+    private static volatile CompletionRing instance;
+
+    private final ByteBuffer buffer;
+    private final int mask;
+    private final PendingLookups pending = Interface.PENDING_LOOKUPS;
+
+    public static CompletionRing getInstance() {
+        if (instance == null) {
+            synchronized (CompletionRing.class) {
+                if (instance == null) {
+                    instance = new CompletionRing();
+                }
+            }
+        }
+        return instance;
+    }
+
+    private CompletionRing() {
+        buffer = Interface.completion_ring(CAPACITY).order(ByteOrder.nativeOrder());
+        mask = buffer.capacity() - 1;
+        final Thread poller = new Thread(this::poll, "unbound4j-completions");
+        poller.setDaemon(true);
+        poller.start();
+    }
+
+    public CompletableFuture<String> reverseLookup(int ctxId, byte[] addr) {
+        // Register the future first, the result may be written to the ring before the call returns
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = pending.add(future);
+        try {
+            Interface.reverse_lookup_to_ring(ctxId, addr, id);
+        } catch (RuntimeException e) {
+            pending.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    public CompletableFuture<String> reverseLookupV4(int ctxId, int addr) {
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = pending.add(future);
+        try {
+            Interface.reverse_lookup_v4_to_ring(ctxId, addr, id);
+        } catch (RuntimeException e) {
+            pending.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    public CompletableFuture<String> reverseLookupV6(int ctxId, long addrHi, long addrLo) {
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = pending.add(future);
+        try {
+            Interface.reverse_lookup_v6_to_ring(ctxId, addrHi, addrLo, id);
+        } catch (RuntimeException e) {
+            pending.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    public CompletableFuture<String>[] reverseLookupBatch(int ctxId, byte[] addrs, int count) {
+        @SuppressWarnings("unchecked")
+        final CompletableFuture<String>[] futures = new CompletableFuture[count];
+        for (int i = 0; i < count; i++) {
+            futures[i] = new CompletableFuture<>();
+        }
+        final long firstId = pending.addAll(futures);
+        try {
+            Interface.reverse_lookup_batch_to_ring(ctxId, addrs, count, firstId);
+        } catch (RuntimeException e) {
+            for (int i = 0; i < count; i++) {
+                pending.remove(firstId + i);
+            }
+            throw e;
+        }
+        return futures;
+    }
+
+    private void poll() {
+        final ByteBuffer view = buffer.duplicate();
+        byte[] text = new byte[256];
+        long consumed = 0;
+        while (true) {
+            final long available;
+            try {
+                available = Interface.completion_ring_poll(consumed, POLL_TIMEOUT_MS);
+            } catch (RuntimeException e) {
+                LOG.error("Failed to poll the completion ring.", e);
+                return;
+            }
+
+            while (consumed < available) {
+                final int offset = (int)(consumed & mask);
+                final int length = buffer.getInt(offset);
+                final int status = buffer.getInt(offset + 4);
+                if (status != STATUS_PADDING) {
+                    final long id = buffer.getLong(offset + 8);
+                    final int textLen = buffer.getInt(offset + 16);
+                    String hostname = null;
+                    if (textLen >= 0) {
+                        if (textLen > text.length) {
+                            text = new byte[textLen];
+                        }
+                        view.position(offset + HEADER_LEN);
+                        view.get(text, 0, textLen);
+                        hostname = new String(text, 0, textLen, StandardCharsets.UTF_8);
+                    }
+                    try {
+                        // Results that don't fit in the ring are completed through Interface.complete() instead
+                        if (!pending.complete(id, status, hostname)) {
+                            LOG.warn("No lookup found for completion with id {}.", id);
+                        }
+                    } catch (RuntimeException e) {
+                        LOG.warn("Error completing lookup with id {}.", id, e);
+                    }
+                }
+                consumed += length;
+            }
+        }
+    }
+}
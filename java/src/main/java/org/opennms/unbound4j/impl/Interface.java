@@ -16,8 +16,12 @@
 
 package org.opennms.unbound4j.impl;
 
+import java.io.ByteArrayOutputStream;
+import java.nio.ByteBuffer;
 import java.util.concurrent.CompletableFuture;
 
+import org.opennms.unbound4j.api.LookupFailedException;
+import org.opennms.unbound4j.api.PrefixRule;
 import org.opennms.unbound4j.api.Unbound4jConfig;
 
 /**
@@ -31,13 +35,174 @@ import org.opennms.unbound4j.api.Unbound4jConfig;
  */
 public class Interface {
 
+    /**
+     * Lookups made through this interface are identified by an id, and completed by the native code
+     * through {@link #complete(long, int, String)} or the completion ring.
+     */
+    static final PendingLookups PENDING_LOOKUPS = new PendingLookups();
+
     protected static native String version();
 
-    protected static native int create_context(Unbound4jConfig config);
+    /**
+     * @param prefixRules the prefix rules of the config, see {@link #packPrefixRules(Unbound4jConfig)}
+     */
+    protected static native int create_context(Unbound4jConfig config, byte[] prefixRules);
 
     protected static native void delete_context(int ctx_id);
 
-    protected static native CompletableFuture<String> reverse_lookup(int ctx_id, byte[] addr);
+    /**
+     * Looks up the address, the result is passed to {@link #complete(long, int, String)} along with the given id.
+     */
+    protected static native void reverse_lookup(int ctx_id, byte[] addr, long id);
+
+    /**
+     * Same as {@link #reverse_lookup(int, byte[], long)}, with the IPv4 address given as an int in network byte order,
+     * i.e. 192.0.2.1 is 0xC0000201.
+     */
+    protected static native void reverse_lookup_v4(int ctx_id, int addr, long id);
+
+    /**
+     * Same as {@link #reverse_lookup(int, byte[], long)}, with the first and last 8 bytes of the IPv6 address
+     * given as longs in network byte order.
+     */
+    protected static native void reverse_lookup_v6(int ctx_id, long addr_hi, long addr_lo, long id);
+
+    /**
+     * Looks up several addresses at once.
+     *
+     * @param addrs the addresses, packed one after the other with each preceded by a byte giving its length
+     * @param count the number of addresses
+     * @param firstId id of the lookup for the first address, the following addresses use consecutive ids
+     */
+    protected static native void reverse_lookup_batch(int ctx_id, byte[] addrs, int count, long firstId);
+
+    protected static native long[] get_stats(int ctx_id);
+
+    /**
+     * Replaces the overrides of the context with those of the given file, or removes them if the path is null.
+     */
+    protected static native void set_overrides(int ctx_id, String path);
+
+    /**
+     * Creates the ring that results are written to by the *_to_ring variants of the lookups,
+     * or returns the existing one. There is only one ring per process.
+     *
+     * @param capacity size of the ring in bytes, rounded up to a power of 2
+     * @return a direct buffer over the ring
+     */
+    protected static native ByteBuffer completion_ring(int capacity);
+
+    /**
+     * Releases the space used by the records before the consumed position, and waits for more records to be written.
+     *
+     * @return the position up to which records can be read
+     */
+    protected static native long completion_ring_poll(long consumed, int timeoutMs);
+
+    protected static native void reverse_lookup_to_ring(int ctx_id, byte[] addr, long id);
+
+    protected static native void reverse_lookup_v4_to_ring(int ctx_id, int addr, long id);
+
+    protected static native void reverse_lookup_v6_to_ring(int ctx_id, long addr_hi, long addr_lo, long id);
+
+    /**
+     * Same as {@link #reverse_lookup_batch(int, byte[], int, long)}, but the results are written to the completion ring.
+     */
+    protected static native void reverse_lookup_batch_to_ring(int ctx_id, byte[] addrs, int count, long firstId);
+
+    static int createContext(Unbound4jConfig config) {
+        return create_context(config, packPrefixRules(config));
+    }
+
+    /**
+     * Packs the prefix rules one after the other, each made up of the action, the length of the address
+     * followed by the address, the prefix length, and the id of the context as a 4 byte integer.
+     */
+    static byte[] packPrefixRules(Unbound4jConfig config) {
+        final ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        for (PrefixRule rule : config.getPrefixRules()) {
+            final byte[] addr = rule.getAddress().getAddress();
+            packed.write(rule.getAction().ordinal());
+            packed.write(addr.length);
+            packed.write(addr, 0, addr.length);
+            packed.write(rule.getPrefixLength());
+            final int contextId = rule.getContextId();
+            packed.write(contextId >>> 24);
+            packed.write(contextId >>> 16);
+            packed.write(contextId >>> 8);
+            packed.write(contextId);
+        }
+        return packed.toByteArray();
+    }
+
+    static CompletableFuture<String> reverseLookup(int ctxId, byte[] addr) {
+        // Register the future first, the lookup may complete before the call returns
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = PENDING_LOOKUPS.add(future);
+        try {
+            reverse_lookup(ctxId, addr, id);
+        } catch (RuntimeException e) {
+            PENDING_LOOKUPS.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    static CompletableFuture<String> reverseLookupV4(int ctxId, int addr) {
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = PENDING_LOOKUPS.add(future);
+        try {
+            reverse_lookup_v4(ctxId, addr, id);
+        } catch (RuntimeException e) {
+            PENDING_LOOKUPS.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    static CompletableFuture<String> reverseLookupV6(int ctxId, long addrHi, long addrLo) {
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final long id = PENDING_LOOKUPS.add(future);
+        try {
+            reverse_lookup_v6(ctxId, addrHi, addrLo, id);
+        } catch (RuntimeException e) {
+            PENDING_LOOKUPS.remove(id);
+            throw e;
+        }
+        return future;
+    }
+
+    static CompletableFuture<String>[] reverseLookupBatch(int ctxId, byte[] addrs, int count) {
+        @SuppressWarnings("unchecked")
+        final CompletableFuture<String>[] futures = new CompletableFuture[count];
+        for (int i = 0; i < count; i++) {
+            futures[i] = new CompletableFuture<>();
+        }
+        final long firstId = PENDING_LOOKUPS.addAll(futures);
+        try {
+            reverse_lookup_batch(ctxId, addrs, count, firstId);
+        } catch (RuntimeException e) {
+            for (int i = 0; i < count; i++) {
+                PENDING_LOOKUPS.remove(firstId + i);
+            }
+            throw e;
+        }
+        return futures;
+    }
+
+    /**
+     * Called by the native code to complete a lookup.
+     */
+    static void complete(long id, int status, String hostname) {
+        PENDING_LOOKUPS.complete(id, status, hostname);
+    }
+
+    /**
+     * @return the shared exception for the status of a failed lookup
+     */
+    static LookupFailedException failure(int status) {
+        return PendingLookups.failure(status);
+    }
 
     /** Load the unbound4j runtime C library. */
     static void init() {
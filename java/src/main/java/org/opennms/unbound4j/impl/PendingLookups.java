@@ -0,0 +1,202 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.impl;
+
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.atomic.AtomicLong;
+
+import org.opennms.unbound4j.api.LookupFailedException;
+
+/**
+ * Futures of the lookups that are in flight, indexed by the id the native code completes them with.
+ *
+ * Ids are handed out sequentially and spread over a number of stripes, each being an open-addressing
+ * hash table keyed by primitive longs, so that registering a lookup allocates nothing but its future.
+ */
+public class PendingLookups {
+    // Statuses reported by the native code, keep in sync with enum ub4j_status in unbound4j.h
+    public static final int STATUS_OK = 0;
+    public static final int STATUS_STALE = 7;
+    public static final int STATUS_NOT_ADMITTED = 8;
+    private static final LookupFailedException.Reason[] STATUS_REASONS = {
+            null,
+            LookupFailedException.Reason.TIMEOUT,
+            LookupFailedException.Reason.REJECTED,
+            LookupFailedException.Reason.INVALID_ADDRESS,
+            LookupFailedException.Reason.INVALID_CONTEXT,
+            LookupFailedException.Reason.RESOLVER_ERROR,
+            LookupFailedException.Reason.INTERNAL_ERROR
+    };
+
+    private static final int STRIPES = 64;
+    private static final int INITIAL_STRIPE_CAPACITY = 256;
+
+    private final AtomicLong nextId = new AtomicLong(1); // 0 marks empty slots
+    private final Stripe[] stripes = new Stripe[STRIPES];
+
+    public PendingLookups() {
+        for (int i = 0; i < STRIPES; i++) {
+            stripes[i] = new Stripe();
+        }
+    }
+
+    /**
+     * @return the id the future was registered with
+     */
+    public long add(CompletableFuture<String> future) {
+        final long id = nextId.getAndIncrement();
+        stripe(id).put(id, future);
+        return id;
+    }
+
+    /**
+     * Registers the futures with consecutive ids.
+     *
+     * @return the id of the first future
+     */
+    public long addAll(CompletableFuture<String>[] futures) {
+        final long firstId = nextId.getAndAdd(futures.length);
+        for (int i = 0; i < futures.length; i++) {
+            stripe(firstId + i).put(firstId + i, futures[i]);
+        }
+        return firstId;
+    }
+
+    public CompletableFuture<String> remove(long id) {
+        return stripe(id).remove(id);
+    }
+
+    public int size() {
+        int size = 0;
+        for (Stripe stripe : stripes) {
+            size += stripe.size();
+        }
+        return size;
+    }
+
+    /**
+     * Completes the lookup with the given id, exceptionally unless the status is {@link #STATUS_OK},
+     * {@link #STATUS_STALE} when it was answered with an expired cache entry, or {@link #STATUS_NOT_ADMITTED}
+     * when it was left unresolved by the admission filter.
+     *
+     * @return false if no lookup was registered with the id
+     */
+    public boolean complete(long id, int status, String hostname) {
+        final CompletableFuture<String> future = remove(id);
+        if (future == null) {
+            return false;
+        } else if (status != STATUS_OK && status != STATUS_STALE && status != STATUS_NOT_ADMITTED) {
+            future.completeExceptionally(failure(status));
+        } else {
+            future.complete(hostname);
+        }
+        return true;
+    }
+
+    /**
+     * @return the shared exception for the status of a failed lookup
+     */
+    static LookupFailedException failure(int status) {
+        if (status > STATUS_OK && status < STATUS_REASONS.length) {
+            return LookupFailedException.forReason(STATUS_REASONS[status]);
+        }
+        return LookupFailedException.forReason(LookupFailedException.Reason.INTERNAL_ERROR);
+    }
+
+    private Stripe stripe(long id) {
+        return stripes[(int)(id & (STRIPES - 1))];
+    }
+
+    private static final class Stripe {
+        private long[] keys = new long[INITIAL_STRIPE_CAPACITY];
+        private Object[] values = new Object[INITIAL_STRIPE_CAPACITY];
+        private int size;
+
+        private static int slot(long id, int mask) {
+            // The low bits select the stripe, mix the rest
+            return (int)(((id >>> 6) * 0x9E3779B97F4A7C15L) >>> 32) & mask;
+        }
+
+        synchronized void put(long id, CompletableFuture<String> future) {
+            if ((size + 1) * 2 > keys.length) {
+                resize(keys.length * 2);
+            }
+            final int mask = keys.length - 1;
+            int i = slot(id, mask);
+            while (keys[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            keys[i] = id;
+            values[i] = future;
+            size++;
+        }
+
+        @SuppressWarnings("unchecked")
+        synchronized CompletableFuture<String> remove(long id) {
+            final int mask = keys.length - 1;
+            int i = slot(id, mask);
+            while (keys[i] != id) {
+                if (keys[i] == 0) {
+                    return null;
+                }
+                i = (i + 1) & mask;
+            }
+            final CompletableFuture<String> future = (CompletableFuture<String>)values[i];
+
+            // Shift back the entries that follow, so that probing never stops short of them
+            int j = i;
+            while (true) {
+                j = (j + 1) & mask;
+                if (keys[j] == 0) {
+                    break;
+                }
+                final int k = slot(keys[j], mask);
+                if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+                    keys[i] = keys[j];
+                    values[i] = values[j];
+                    i = j;
+                }
+            }
+            keys[i] = 0;
+            values[i] = null;
+            size--;
+            return future;
+        }
+
+        synchronized int size() {
+            return size;
+        }
+
+        private void resize(int capacity) {
+            final long[] oldKeys = keys;
+            final Object[] oldValues = values;
+            keys = new long[capacity];
+            values = new Object[capacity];
+            final int mask = capacity - 1;
+            for (int n = 0; n < oldKeys.length; n++) {
+                if (oldKeys[n] != 0) {
+                    int i = slot(oldKeys[n], mask);
+                    while (keys[i] != 0) {
+                        i = (i + 1) & mask;
+                    }
+                    keys[i] = oldKeys[n];
+                    values[i] = oldValues[n];
+                }
+            }
+        }
+    }
+}
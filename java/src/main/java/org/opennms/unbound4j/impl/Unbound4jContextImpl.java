@@ -16,13 +16,47 @@
 
 package org.opennms.unbound4j.impl;
 
+import java.util.concurrent.Executor;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.RejectedExecutionException;
+
 import org.opennms.unbound4j.api.Unbound4jContext;
 
 public class Unbound4jContextImpl implements Unbound4jContext {
     private final int id;
+    private final CompletionRing completionRing;
+    private final Executor completionExecutor;
+    private final ExecutorService ownedExecutor;
 
     public Unbound4jContextImpl(int id) {
+        this(id, null, null, null);
+    }
+
+    /**
+     * @param completionRing the ring lookups are completed through, or null to complete them with upcalls
+     * @param completionExecutor the executor the futures are completed on, or null to complete them inline
+     * @param ownedExecutor an executor that was created for this context, and is shut down along with it
+     */
+    public Unbound4jContextImpl(int id, CompletionRing completionRing, Executor completionExecutor, ExecutorService ownedExecutor) {
         this.id = id;
+        this.completionRing = completionRing;
+        this.completionExecutor = completionExecutor != null ? orInline(completionExecutor) : null;
+        this.ownedExecutor = ownedExecutor;
+    }
+
+    /**
+     * Runs tasks on the given executor, or on the calling thread once it no longer accepts them. Lookups can
+     * still complete after the context is closed: those failed by deleting it are only completed by the
+     * completion ring's poller later on.
+     */
+    private static Executor orInline(Executor executor) {
+        return command -> {
+            try {
+                executor.execute(command);
+            } catch (RejectedExecutionException e) {
+                command.run();
+            }
+        };
     }
 
     @Override
@@ -30,8 +64,23 @@ public class Unbound4jContextImpl implements Unbound4jContext {
         return id;
     }
 
+    public CompletionRing getCompletionRing() {
+        return completionRing;
+    }
+
+    public Executor getCompletionExecutor() {
+        return completionExecutor;
+    }
+
     @Override
     public void close() {
-        Interface.delete_context(id);
+        try {
+            Interface.delete_context(id);
+        } finally {
+            // Lookups completed from here on run inline, see orInline()
+            if (ownedExecutor != null) {
+                ownedExecutor.shutdown();
+            }
+        }
     }
 }
@@ -17,25 +17,119 @@
 package org.opennms.unbound4j.impl;
 
 import java.net.InetAddress;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.List;
 import java.util.Optional;
 import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.Executor;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.atomic.AtomicInteger;
 
 import org.opennms.unbound4j.api.Unbound4j;
 import org.opennms.unbound4j.api.Unbound4jConfig;
 import org.opennms.unbound4j.api.Unbound4jContext;
+import org.opennms.unbound4j.api.Unbound4jStats;
 
 public class Unbound4jImpl implements Unbound4j {
 
     @Override
     public Unbound4jContext newContext(Unbound4jConfig config) {
-        return new Unbound4jContextImpl(Interface.create_context(config));
+        final CompletionRing completionRing = config.isUseCompletionRing() ? CompletionRing.getInstance() : null;
+        final int id = Interface.createContext(config);
+
+        Executor completionExecutor = config.getCompletionExecutor();
+        ExecutorService ownedExecutor = null;
+        if (completionExecutor == null && config.getCompletionThreads() > 0) {
+            final AtomicInteger threadIndex = new AtomicInteger();
+            ownedExecutor = Executors.newFixedThreadPool(config.getCompletionThreads(), r -> {
+                final Thread thread = new Thread(r, "unbound4j-completion-" + id + "-" + threadIndex.getAndIncrement());
+                thread.setDaemon(true);
+                return thread;
+            });
+            completionExecutor = ownedExecutor;
+        }
+        return new Unbound4jContextImpl(id, completionRing, completionExecutor, ownedExecutor);
     }
 
     @Override
     public CompletableFuture<Optional<String>> reverseLookup(Unbound4jContext ctx, InetAddress addr) {
         final byte[] bytes = addr.getAddress();
-        return Interface.reverse_lookup(ctx.getId(), bytes)
-                .thenApply(Optional::ofNullable);
+        final CompletionRing completionRing = getCompletionRing(ctx);
+        final CompletableFuture<String> future = completionRing != null ?
+                completionRing.reverseLookup(ctx.getId(), bytes) : Interface.reverseLookup(ctx.getId(), bytes);
+        return toResult(ctx, future);
+    }
+
+    @Override
+    public CompletableFuture<Optional<String>> reverseLookupV4(Unbound4jContext ctx, int addr) {
+        final CompletionRing completionRing = getCompletionRing(ctx);
+        final CompletableFuture<String> future = completionRing != null ?
+                completionRing.reverseLookupV4(ctx.getId(), addr) : Interface.reverseLookupV4(ctx.getId(), addr);
+        return toResult(ctx, future);
+    }
+
+    @Override
+    public CompletableFuture<Optional<String>> reverseLookupV6(Unbound4jContext ctx, long addrHi, long addrLo) {
+        final CompletionRing completionRing = getCompletionRing(ctx);
+        final CompletableFuture<String> future = completionRing != null ?
+                completionRing.reverseLookupV6(ctx.getId(), addrHi, addrLo) : Interface.reverseLookupV6(ctx.getId(), addrHi, addrLo);
+        return toResult(ctx, future);
+    }
+
+    @Override
+    public List<CompletableFuture<Optional<String>>> reverseLookupAll(Unbound4jContext ctx, Collection<InetAddress> addrs) {
+        // Pack the addresses one after the other, each preceded by its length
+        final List<byte[]> addrBytes = new ArrayList<>(addrs.size());
+        int packedLength = 0;
+        for (InetAddress addr : addrs) {
+            final byte[] bytes = addr.getAddress();
+            addrBytes.add(bytes);
+            packedLength += 1 + bytes.length;
+        }
+        final byte[] packed = new byte[packedLength];
+        int offset = 0;
+        for (byte[] bytes : addrBytes) {
+            packed[offset++] = (byte)bytes.length;
+            System.arraycopy(bytes, 0, packed, offset, bytes.length);
+            offset += bytes.length;
+        }
+
+        final CompletionRing completionRing = getCompletionRing(ctx);
+        final CompletableFuture<String>[] futures = completionRing != null ?
+                completionRing.reverseLookupBatch(ctx.getId(), packed, addrBytes.size()) :
+                Interface.reverseLookupBatch(ctx.getId(), packed, addrBytes.size());
+        final List<CompletableFuture<Optional<String>>> results = new ArrayList<>(futures.length);
+        for (CompletableFuture<String> future : futures) {
+            results.add(toResult(ctx, future));
+        }
+        return results;
+    }
+
+    @Override
+    public Unbound4jStats getStats(Unbound4jContext ctx) {
+        return new Unbound4jStats(Interface.get_stats(ctx.getId()));
+    }
+
+    @Override
+    public void setOverridesFile(Unbound4jContext ctx, String file) {
+        Interface.set_overrides(ctx.getId(), file);
+    }
+
+    /**
+     * Hands the completion over to the context's executor, if it has one, so that the dependent
+     * actions don't hold up the thread that delivers the results.
+     */
+    private static CompletableFuture<Optional<String>> toResult(Unbound4jContext ctx, CompletableFuture<String> future) {
+        final Executor completionExecutor = ctx instanceof Unbound4jContextImpl ?
+                ((Unbound4jContextImpl)ctx).getCompletionExecutor() : null;
+        return completionExecutor != null ? future.thenApplyAsync(Optional::ofNullable, completionExecutor) :
+                future.thenApply(Optional::ofNullable);
+    }
+
+    private static CompletionRing getCompletionRing(Unbound4jContext ctx) {
+        return ctx instanceof Unbound4jContextImpl ? ((Unbound4jContextImpl)ctx).getCompletionRing() : null;
     }
 
 }
@@ -19,10 +19,24 @@ package org.opennms.unbound4j.impl;
 import static org.hamcrest.MatcherAssert.assertThat;
 import static org.hamcrest.Matchers.anyOf;
 import static org.hamcrest.Matchers.equalTo;
+import static org.hamcrest.Matchers.greaterThan;
 import static org.hamcrest.Matchers.nullValue;
+import static org.hamcrest.Matchers.sameInstance;
+import static org.junit.Assert.fail;
 
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.IOException;
 import java.net.InetAddress;
 import java.net.UnknownHostException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
 import java.util.concurrent.ExecutionException;
 import java.util.concurrent.TimeUnit;
 
@@ -32,7 +46,10 @@ import org.junit.BeforeClass;
 import org.junit.Rule;
 import org.junit.Test;
 import org.junit.rules.TemporaryFolder;
+import org.opennms.unbound4j.api.LookupFailedException;
+import org.opennms.unbound4j.api.PrefixRule;
 import org.opennms.unbound4j.api.Unbound4jConfig;
+import org.opennms.unbound4j.api.Unbound4jStats;
 
 public class InterfaceTest {
 
@@ -48,7 +65,7 @@ public class InterfaceTest {
     
     @Before
     public void setUp() {
-        ctx = Interface.create_context(Unbound4jConfig.newBuilder()
+        ctx = Interface.createContext(Unbound4jConfig.newBuilder()
                 .useSystemResolver(true)
                 .withRequestTimeout(15, TimeUnit.SECONDS)
                 .build());
@@ -64,15 +81,306 @@ public class InterfaceTest {
     public void canReverseLoookup() throws UnknownHostException, ExecutionException, InterruptedException {
         // IPv4
         byte[] addr = InetAddress.getByName("1.1.1.1").getAddress();
-        assertThat(Interface.reverse_lookup(ctx, addr).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+        assertThat(Interface.reverseLookup(ctx, addr).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
 
         // IPv6
         addr = InetAddress.getByName("2606:4700:4700::1111").getAddress();
-        assertThat(Interface.reverse_lookup(ctx, addr).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+        assertThat(Interface.reverseLookup(ctx, addr).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
 
         // No result
         addr = InetAddress.getByName("198.51.100.1").getAddress();
-        assertThat(Interface.reverse_lookup(ctx, addr).get(), nullValue());
+        assertThat(Interface.reverseLookup(ctx, addr).get(), nullValue());
+    }
+
+    @Test(timeout = 30000)
+    public void canReverseLookupPrimitiveAddresses() throws ExecutionException, InterruptedException {
+        // 1.1.1.1
+        assertThat(Interface.reverseLookupV4(ctx, 0x01010101).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+
+        // 2606:4700:4700::1111
+        assertThat(Interface.reverseLookupV6(ctx, 0x2606470047000000L, 0x1111L).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+
+        // 198.51.100.1
+        assertThat(Interface.reverseLookupV4(ctx, 0xC6336401).get(), nullValue());
+    }
+
+    @Test(timeout = 30000)
+    public void canReverseLookupInBatches() throws UnknownHostException, ExecutionException, InterruptedException {
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        for (String addr : new String[]{"1.1.1.1", "2606:4700:4700::1111", "198.51.100.1"}) {
+            byte[] bytes = InetAddress.getByName(addr).getAddress();
+            packed.write(bytes.length);
+            packed.write(bytes, 0, bytes.length);
+        }
+        // An invalid address length
+        packed.write(3);
+        packed.write(new byte[]{1, 2, 3}, 0, 3);
+
+        CompletableFuture<String>[] futures = Interface.reverseLookupBatch(ctx, packed.toByteArray(), 4);
+        assertThat(futures.length, equalTo(4));
+        assertThat(futures[0].get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+        assertThat(futures[1].get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+        assertThat(futures[2].get(), nullValue());
+        try {
+            futures[3].get();
+            fail("Expected the lookup to fail.");
+        } catch (ExecutionException e) {
+            assertThat(e.getCause(), sameInstance(LookupFailedException.forReason(LookupFailedException.Reason.INVALID_ADDRESS)));
+        }
+
+        // Nothing is left behind once the lookups complete
+        assertThat(Interface.PENDING_LOOKUPS.size(), equalTo(0));
+    }
+
+    @Test(timeout = 30000)
+    public void canCompleteLookupsThroughTheRing() throws UnknownHostException, ExecutionException, InterruptedException {
+        CompletionRing ring = CompletionRing.getInstance();
+        byte[] addr = InetAddress.getByName("1.1.1.1").getAddress();
+        assertThat(ring.reverseLookup(ctx, addr).get(), anyOf(equalTo("one.one.one.one."), nullValue()));
+
+        addr = InetAddress.getByName("198.51.100.1").getAddress();
+        assertThat(ring.reverseLookup(ctx, addr).get(), nullValue());
+
+        // Errors are carried through the ring too
+        ByteArrayOutputStream packed = new ByteArrayOutputStream();
+        packed.write(4);
+        packed.write(addr, 0, addr.length);
+        packed.write(3);
+        packed.write(new byte[]{1, 2, 3}, 0, 3);
+        CompletableFuture<String>[] futures = ring.reverseLookupBatch(ctx, packed.toByteArray(), 2);
+        assertThat(futures[0].get(), nullValue());
+        try {
+            futures[1].get();
+            fail("Expected the lookup to fail.");
+        } catch (ExecutionException e) {
+            // expected
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canCoalesceLookupsForTheSameAddress() throws UnknownHostException, ExecutionException, InterruptedException {
+        byte[] addr = InetAddress.getByName("1.1.1.1").getAddress();
+        List<CompletableFuture<String>> futures = new ArrayList<>();
+        for (int i = 0; i < 10; i++) {
+            futures.add(Interface.reverseLookup(ctx, addr));
+        }
+        // Every lookup gets the same answer
+        String hostname = futures.get(0).get();
+        for (CompletableFuture<String> future : futures) {
+            assertThat(future.get(), equalTo(hostname));
+        }
+
+        Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(ctx));
+        assertThat(stats.getLookups(), equalTo(10L));
+        assertThat(stats.getQueriesSent() + stats.getCoalesced(), equalTo(10L));
+    }
+
+    @Test(timeout = 30000)
+    public void canCacheNegativeAnswers() throws ExecutionException, InterruptedException {
+        final int cacheCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withCacheCapacity(1024)
+                .build());
+        try {
+            // 198.51.100.1 has no PTR record, which is remembered like a hostname would be
+            assertThat(Interface.reverseLookupV4(cacheCtx, 0xC6336401).get(), nullValue());
+            assertThat(Interface.reverseLookupV4(cacheCtx, 0xC6336401).get(), nullValue());
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(cacheCtx));
+            assertThat(stats.getQueriesSent(), equalTo(1L));
+            assertThat(stats.getCacheHits(), equalTo(1L));
+        } finally {
+            Interface.delete_context(cacheCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canDisableCachingOfNegativeAnswers() throws ExecutionException, InterruptedException {
+        final int cacheCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withCacheCapacity(1024)
+                .withCacheNxdomainTtl(0, TimeUnit.SECONDS)
+                .build());
+        try {
+            assertThat(Interface.reverseLookupV4(cacheCtx, 0xC6336401).get(), nullValue());
+            assertThat(Interface.reverseLookupV4(cacheCtx, 0xC6336401).get(), nullValue());
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(cacheCtx));
+            assertThat(stats.getQueriesSent(), equalTo(2L));
+            assertThat(stats.getCacheHits(), equalTo(0L));
+        } finally {
+            Interface.delete_context(cacheCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canShortCircuitSpecialPurposeAddresses() throws UnknownHostException, ExecutionException, InterruptedException {
+        final int internalCtx = Interface.createContext(Unbound4jConfig.newBuilder().build());
+        final int rulesCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .useSpecialPurposeRules(true)
+                .withPrefixRule(PrefixRule.routeTo(InetAddress.getByName("10.0.0.0"), 8, new Unbound4jContextImpl(internalCtx)))
+                .build());
+        try {
+            // Answered without a query
+            assertThat(Interface.reverseLookup(rulesCtx, InetAddress.getByName("192.168.1.1").getAddress()).get(), nullValue());
+            assertThat(Interface.reverseLookup(rulesCtx, InetAddress.getByName("fe80::1").getAddress()).get(), nullValue());
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(rulesCtx));
+            assertThat(stats.getShortCircuited(), equalTo(2L));
+            assertThat(stats.getQueriesSent(), equalTo(0L));
+
+            // Resolved by the other context
+            Interface.reverseLookup(rulesCtx, InetAddress.getByName("10.1.2.3").getAddress()).get();
+            assertThat(new Unbound4jStats(Interface.get_stats(internalCtx)).getLookups(), equalTo(1L));
+        } finally {
+            Interface.delete_context(rulesCtx);
+            Interface.delete_context(internalCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canAnswerFromOverrides() throws IOException, ExecutionException, InterruptedException {
+        final File first = writeOverrides(0xC6336401, "first.example");
+        final File second = writeOverrides(0xC6336401, "second.example");
+        final int overridesCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withOverridesFile(first.getAbsolutePath())
+                .build());
+        try {
+            assertThat(Interface.reverseLookupV4(overridesCtx, 0xC6336401).get(), equalTo("first.example."));
+
+            Interface.set_overrides(overridesCtx, second.getAbsolutePath());
+            assertThat(Interface.reverseLookupV4(overridesCtx, 0xC6336401).get(), equalTo("second.example."));
+
+            Interface.set_overrides(overridesCtx, null);
+            assertThat(Interface.reverseLookupV4(overridesCtx, 0xC6336401).get(), nullValue());
+            assertThat(new Unbound4jStats(Interface.get_stats(overridesCtx)).getOverrideHits(), equalTo(2L));
+        } finally {
+            Interface.delete_context(overridesCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canWarmCacheFromSnapshot() throws IOException, ExecutionException, InterruptedException {
+        final File snapshot = new File(tempFolder.getRoot(), "cache.snapshot");
+        final Unbound4jConfig config = Unbound4jConfig.newBuilder()
+                .withCacheCapacity(1024)
+                .withCacheSnapshotFile(snapshot.getAbsolutePath())
+                .withCacheSnapshotInterval(0, TimeUnit.SECONDS)
+                .build();
+
+        // Written when the context is deleted
+        int snapshotCtx = Interface.createContext(config);
+        final String hostname = Interface.reverseLookupV4(snapshotCtx, 0x01010101).get();
+        Interface.delete_context(snapshotCtx);
+        assertThat(snapshot.exists(), equalTo(true));
+
+        // And loaded when it's created again
+        snapshotCtx = Interface.createContext(config);
+        try {
+            assertThat(Interface.reverseLookupV4(snapshotCtx, 0x01010101).get(), equalTo(hostname));
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(snapshotCtx));
+            assertThat(stats.getCacheHits(), equalTo(1L));
+            assertThat(stats.getQueriesSent(), equalTo(0L));
+        } finally {
+            Interface.delete_context(snapshotCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canShareCacheBetweenContexts() throws IOException, ExecutionException, InterruptedException {
+        final String name = "/unbound4j-test-" + System.nanoTime();
+        final Unbound4jConfig config = Unbound4jConfig.newBuilder()
+                .withSharedCache(name, 1024)
+                .build();
+        final int firstCtx = Interface.createContext(config);
+        final int secondCtx = Interface.createContext(config);
+        try {
+            // Contexts attach to the segment independently, just like those of another process would
+            final String hostname = Interface.reverseLookupV4(firstCtx, 0x01010101).get();
+            assertThat(Interface.reverseLookupV4(secondCtx, 0x01010101).get(), equalTo(hostname));
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(secondCtx));
+            assertThat(stats.getSharedCacheHits(), equalTo(1L));
+            assertThat(stats.getQueriesSent(), equalTo(0L));
+        } finally {
+            Interface.delete_context(firstCtx);
+            Interface.delete_context(secondCtx);
+            Files.deleteIfExists(Paths.get("/dev/shm" + name));
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canAdmitOnlyAddressesThatComeBack() throws ExecutionException, InterruptedException {
+        final int admissionCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withAdmissionFilter(2, 1, TimeUnit.MINUTES)
+                .build());
+        try {
+            // Seen once, answered without a query
+            assertThat(Interface.reverseLookupV4(admissionCtx, 0xC6336401).get(), nullValue());
+            Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(admissionCtx));
+            assertThat(stats.getNotAdmitted(), equalTo(1L));
+            assertThat(stats.getQueriesSent(), equalTo(0L));
+
+            // Seen twice, resolved
+            assertThat(Interface.reverseLookupV4(admissionCtx, 0xC6336401).get(), nullValue());
+            stats = new Unbound4jStats(Interface.get_stats(admissionCtx));
+            assertThat(stats.getNotAdmitted(), equalTo(1L));
+            assertThat(stats.getQueriesSent(), equalTo(1L));
+        } finally {
+            Interface.delete_context(admissionCtx);
+        }
+    }
+
+    @Test(timeout = 30000)
+    public void canBoundNativeMemory() {
+        final int cacheCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withCacheCapacity(1024)
+                .build());
+        final long reservedBytes;
+        try {
+            final Unbound4jStats stats = new Unbound4jStats(Interface.get_stats(cacheCtx));
+            assertThat(stats.getInflightBytes(), greaterThan(0L));
+            assertThat(stats.getCacheBytes(), greaterThan(0L));
+            reservedBytes = stats.getInflightBytes() + stats.getCacheBytes() + stats.getOtherBytes();
+        } finally {
+            Interface.delete_context(cacheCtx);
+        }
+
+        // Everything allocated up front must fit in the budget
+        try {
+            Interface.createContext(Unbound4jConfig.newBuilder()
+                    .withCacheCapacity(1024)
+                    .withMemoryBudget(reservedBytes / 2)
+                    .build());
+            fail("Expected the context creation to fail.");
+        } catch (RuntimeException e) {
+            // expected
+        }
+
+        final int budgetCtx = Interface.createContext(Unbound4jConfig.newBuilder()
+                .withCacheCapacity(1024)
+                .withMemoryBudget(reservedBytes + 4096)
+                .build());
+        try {
+            final Unbound4jStats budgetStats = new Unbound4jStats(Interface.get_stats(budgetCtx));
+            assertThat(budgetStats.getInflightBytes() + budgetStats.getCacheBytes() + budgetStats.getOtherBytes(), equalTo(reservedBytes));
+            assertThat(budgetStats.getHostnameBytes(), equalTo(0L));
+        } finally {
+            Interface.delete_context(budgetCtx);
+        }
+    }
+
+    /**
+     * Writes an overrides file with a single IPv4 address, in the format generated by unbound4j_hostsgen.
+     */
+    private File writeOverrides(int addr, String hostname) throws IOException {
+        final byte[] name = (hostname + ".").getBytes(StandardCharsets.US_ASCII);
+        final ByteBuffer buffer = ByteBuffer.allocate(96 + 1 + name.length + 1).order(ByteOrder.nativeOrder());
+        buffer.put("UB4JOVR1".getBytes(StandardCharsets.US_ASCII));
+        buffer.putInt(0x01020304).putInt(1);
+        buffer.putLong(1).putLong(0); // v4 and v6 counts
+        buffer.putLong(80).putLong(88).putLong(96).putLong(96).putLong(96); // section offsets
+        buffer.putLong(1 + name.length + 1); // length of the strings
+        buffer.putInt(addr).putInt(0);
+        buffer.putInt(1).putInt(0);
+        buffer.put((byte)0).put(name).put((byte)0);
+        final File file = tempFolder.newFile();
+        Files.write(file.toPath(), buffer.array());
+        return file;
     }
 
 }
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.impl;
+
+import static org.hamcrest.MatcherAssert.assertThat;
+import static org.hamcrest.Matchers.equalTo;
+import static org.hamcrest.Matchers.nullValue;
+import static org.hamcrest.Matchers.sameInstance;
+import static org.junit.Assert.fail;
+
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+
+import org.junit.Test;
+import org.opennms.unbound4j.api.LookupFailedException;
+
+public class PendingLookupsTest {
+
+    @Test
+    public void canAddAndRemoveLookups() {
+        PendingLookups pending = new PendingLookups();
+        List<Long> ids = new ArrayList<>();
+        List<CompletableFuture<String>> futures = new ArrayList<>();
+        for (int i = 0; i < 100000; i++) {
+            CompletableFuture<String> future = new CompletableFuture<>();
+            ids.add(pending.add(future));
+            futures.add(future);
+        }
+        assertThat(pending.size(), equalTo(100000));
+
+        // Remove in random order, so that entries get shifted around
+        List<Integer> order = new ArrayList<>();
+        for (int i = 0; i < ids.size(); i++) {
+            order.add(i);
+        }
+        Collections.shuffle(order, new Random(42));
+        for (int i : order) {
+            assertThat(pending.remove(ids.get(i)), sameInstance(futures.get(i)));
+            assertThat(pending.remove(ids.get(i)), nullValue());
+        }
+        assertThat(pending.size(), equalTo(0));
+    }
+
+    @Test
+    public void canCompleteLookupsAddedInBulk() throws Exception {
+        PendingLookups pending = new PendingLookups();
+        @SuppressWarnings("unchecked")
+        CompletableFuture<String>[] futures = new CompletableFuture[5];
+        for (int i = 0; i < futures.length; i++) {
+            futures[i] = new CompletableFuture<>();
+        }
+        long firstId = pending.addAll(futures);
+
+        assertThat(pending.complete(firstId, PendingLookups.STATUS_OK, "one.one.one.one."), equalTo(true));
+        assertThat(pending.complete(firstId + 1, PendingLookups.STATUS_OK, null), equalTo(true));
+        assertThat(pending.complete(firstId + 2, 1 /* timeout */, null), equalTo(true));
+        assertThat(pending.complete(firstId + 2, PendingLookups.STATUS_OK, null), equalTo(false));
+        assertThat(pending.complete(firstId + 3, PendingLookups.STATUS_STALE, "one.one.one.one."), equalTo(true));
+        assertThat(pending.complete(firstId + 4, PendingLookups.STATUS_NOT_ADMITTED, null), equalTo(true));
+
+        assertThat(futures[0].get(), equalTo("one.one.one.one."));
+        assertThat(futures[1].get(), nullValue());
+        try {
+            futures[2].get();
+            fail("Expected the lookup to fail.");
+        } catch (ExecutionException e) {
+            assertThat(e.getCause(), sameInstance(LookupFailedException.forReason(LookupFailedException.Reason.TIMEOUT)));
+        }
+        // Stale answers and addresses left unresolved by the admission filter complete normally
+        assertThat(futures[3].get(), equalTo("one.one.one.one."));
+        assertThat(futures[4].get(), nullValue());
+        assertThat(pending.size(), equalTo(0));
+    }
+}
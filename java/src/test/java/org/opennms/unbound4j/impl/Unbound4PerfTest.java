@@ -37,6 +37,7 @@ import java.util.LinkedList;
 import java.util.List;
 import java.util.Optional;
 import java.util.Random;
+import java.util.concurrent.CompletableFuture;
 import java.util.concurrent.TimeUnit;
 import java.util.concurrent.atomic.AtomicBoolean;
 import java.util.concurrent.atomic.AtomicInteger;
@@ -50,8 +51,6 @@ import com.codahale.metrics.ConsoleReporter;
 import com.codahale.metrics.Meter;
 import com.codahale.metrics.MetricRegistry;
 import com.google.common.base.Stopwatch;
-import com.google.common.cache.Cache;
-import com.google.common.cache.CacheBuilder;
 import com.google.common.net.InetAddresses;
 
 public class Unbound4PerfTest {
@@ -61,12 +60,11 @@ public class Unbound4PerfTest {
             .useSystemResolver(false)
             .withUnboundConfig("/tmp/unbound.conf")
             .withRequestTimeout(5, TimeUnit.SECONDS)
+            .withCacheCapacity(1000000)
+            .withCacheMaxTtl(1, TimeUnit.MINUTES)
+            // No completion executor: cache hits must complete before reverseLookup() returns, see Worker
             .build());
 
-    Cache<InetAddress, Optional<String>> cache = CacheBuilder.newBuilder()
-            .expireAfterWrite(1, TimeUnit.MINUTES)
-            .build();
-
     private final Random r = new Random(1);
 
     private final AtomicBoolean stop = new AtomicBoolean(false);
@@ -92,13 +90,13 @@ public class Unbound4PerfTest {
                 Arrays.asList(src, dst, gw).forEach(addr -> {
                     request.mark();
                     Stopwatch stopwatch = Stopwatch.createStarted();
-                    Optional<String> hostname = cache.getIfPresent(addr);
-                    if (hostname != null) {
+                    CompletableFuture<Optional<String>> future = ub4j.reverseLookup(ctx, addr);
+                    if (future.isDone() && !future.isCompletedExceptionally()) {
+                        // Answers from the cache are returned before the call completes
                         responseCached.mark();
                     } else {
-                        ub4j.reverseLookup(ctx, addr).whenComplete((hostnameFromDns, ex) -> {
+                        future.whenComplete((hostnameFromDns, ex) -> {
                             if (ex == null) {
-                                cache.put(addr, hostnameFromDns);
                                 System.out.printf("Reverse lookup for %s completed successfully in %dms with: %s\n", addr, stopwatch.elapsed(TimeUnit.MILLISECONDS), hostnameFromDns);
                                 responseSuccess.mark();
                             } else {
@@ -139,6 +137,7 @@ public class Unbound4PerfTest {
 
         // Wait until all the requests have completed
         await().atMost(30, TimeUnit.SECONDS).until(request::getCount, equalTo(responseCached.getCount() + responseSuccess.getCount() + responseFailed.getCount()));
+        System.out.println(ub4j.getStats(ctx));
     }
 
     private AtomicInteger nextIpAddress = new AtomicInteger(16843009); // Start at 1.1.1.1
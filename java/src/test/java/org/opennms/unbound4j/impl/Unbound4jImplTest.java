@@ -0,0 +1,99 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package org.opennms.unbound4j.impl;
+
+import static org.hamcrest.MatcherAssert.assertThat;
+import static org.hamcrest.Matchers.equalTo;
+import static org.hamcrest.Matchers.instanceOf;
+import static org.junit.Assert.fail;
+
+import java.io.File;
+import java.net.DatagramSocket;
+import java.net.InetAddress;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.util.Optional;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.TimeUnit;
+
+import org.junit.BeforeClass;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.rules.TemporaryFolder;
+import org.opennms.unbound4j.api.LookupFailedException;
+import org.opennms.unbound4j.api.Unbound4jConfig;
+import org.opennms.unbound4j.api.Unbound4jContext;
+
+public class Unbound4jImplTest {
+
+    @Rule
+    public TemporaryFolder tempFolder = new TemporaryFolder();
+
+    private final Unbound4jImpl ub4j = new Unbound4jImpl();
+
+    @BeforeClass
+    public static void setUpClass() {
+        Interface.init();
+    }
+
+    @Test
+    public void canCompleteOnTheCompletionThreads() throws Exception {
+        final Unbound4jConfig config = Unbound4jConfig.newBuilder()
+                .withCompletionThreads(1)
+                .withRequestTimeout(15, TimeUnit.SECONDS)
+                .build();
+        try (Unbound4jContext ctx = ub4j.newContext(config)) {
+            // The lookup goes out to the network, so it is still outstanding when we add the stage
+            final String threadName = ub4j.reverseLookupV4(ctx, 0xC6336401)
+                    .thenApply(hostname -> Thread.currentThread().getName())
+                    .get();
+            assertThat(threadName, equalTo("unbound4j-completion-" + ctx.getId() + "-0"));
+        }
+    }
+
+    @Test
+    public void canFailOutstandingLookupsOnCloseWithCompletionRing() throws Exception {
+        // A server that never answers, so that the lookup is still outstanding when the context is closed
+        try (DatagramSocket server = new DatagramSocket(0, InetAddress.getLoopbackAddress())) {
+            final File unboundConfig = tempFolder.newFile("unbound.conf");
+            Files.write(unboundConfig.toPath(), ("server:\n" +
+                    "    do-not-query-localhost: no\n" +
+                    "forward-zone:\n" +
+                    "    name: \".\"\n" +
+                    "    forward-addr: 127.0.0.1@" + server.getLocalPort() + "\n").getBytes(StandardCharsets.UTF_8));
+
+            final Unbound4jConfig config = Unbound4jConfig.newBuilder()
+                    .useSystemResolver(false)
+                    .withUnboundConfig(unboundConfig.getAbsolutePath())
+                    .withRequestTimeout(60, TimeUnit.SECONDS)
+                    .useCompletionRing(true)
+                    .withCompletionThreads(1)
+                    .build();
+            final Unbound4jContext ctx = ub4j.newContext(config);
+            final CompletableFuture<Optional<String>> future = ub4j.reverseLookupV4(ctx, 0xC6336401);
+            ctx.close();
+
+            try {
+                future.get(15, TimeUnit.SECONDS);
+                fail("Lookup should have failed when the context was closed");
+            } catch (ExecutionException e) {
+                assertThat(e.getCause(), instanceOf(LookupFailedException.class));
+            }
+        }
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_ADDRKEY_H
+#define UNBOUND4J_ADDRKEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-width representation of an IPv4 or IPv6 address, used to key the caches.
+ *
+ * The address is stored as a 128-bit big-endian number split in two words, with IPv4
+ * addresses stored in their IPv4-mapped IPv6 form (::ffff:a.b.c.d). IPv4-mapped IPv6
+ * addresses are consequently treated as the IPv4 address they map.
+ */
+struct ub4j_addr_key {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+#define UB4J_V4_MAPPED_PREFIX 0x0000ffff00000000ULL
+
+static inline uint64_t ub4j_load_be64(const uint8_t* b) {
+    return ((uint64_t)b[0] << 56) | ((uint64_t)b[1] << 48) | ((uint64_t)b[2] << 40) | ((uint64_t)b[3] << 32) |
+           ((uint64_t)b[4] << 24) | ((uint64_t)b[5] << 16) | ((uint64_t)b[6] << 8) | (uint64_t)b[7];
+}
+
+static inline void ub4j_store_be64(uint8_t* b, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        b[i] = (uint8_t)v;
+        v >>= 8;
+    }
+}
+
+/**
+ * Builds the key for the given address in network byte order.
+ *
+ * @return 0 on success, or -1 if the length is neither 4 or 16
+ */
+static inline int ub4j_addr_key_init(struct ub4j_addr_key* key, const uint8_t* addr, size_t addr_len) {
+    if (addr_len == 4) {
+        key->hi = 0;
+        key->lo = UB4J_V4_MAPPED_PREFIX | ((uint64_t)addr[0] << 24) | ((uint64_t)addr[1] << 16) |
+                  ((uint64_t)addr[2] << 8) | (uint64_t)addr[3];
+        return 0;
+    } else if (addr_len == 16) {
+        key->hi = ub4j_load_be64(addr);
+        key->lo = ub4j_load_be64(addr + 8);
+        return 0;
+    }
+    return -1;
+}
+
+static inline int ub4j_addr_key_is_v4(const struct ub4j_addr_key* key) {
+    return key->hi == 0 && (key->lo & 0xffffffff00000000ULL) == UB4J_V4_MAPPED_PREFIX;
+}
+
+/**
+ * Writes the address back out in network byte order, and returns its length (4 or 16).
+ */
+static inline size_t ub4j_addr_key_to_bytes(const struct ub4j_addr_key* key, uint8_t* addr) {
+    if (ub4j_addr_key_is_v4(key)) {
+        addr[0] = (uint8_t)(key->lo >> 24);
+        addr[1] = (uint8_t)(key->lo >> 16);
+        addr[2] = (uint8_t)(key->lo >> 8);
+        addr[3] = (uint8_t)key->lo;
+        return 4;
+    }
+    ub4j_store_be64(addr, key->hi);
+    ub4j_store_be64(addr + 8, key->lo);
+    return 16;
+}
+
+static inline int ub4j_addr_key_equals(const struct ub4j_addr_key* a, const struct ub4j_addr_key* b) {
+    return a->hi == b->hi && a->lo == b->lo;
+}
+
+/**
+ * Keeps the first prefix_len bits of the address, out of 128, and clears the others.
+ * IPv4 prefixes are offset by the 96 bits of the IPv4-mapped prefix, i.e. a /24 is 120 bits long.
+ */
+static inline void ub4j_addr_key_mask(const struct ub4j_addr_key* key, int prefix_len, struct ub4j_addr_key* prefix) {
+    if (prefix_len <= 0) {
+        prefix->hi = 0;
+        prefix->lo = 0;
+    } else if (prefix_len < 64) {
+        prefix->hi = key->hi & ~(~0ULL >> prefix_len);
+        prefix->lo = 0;
+    } else if (prefix_len == 64) {
+        prefix->hi = key->hi;
+        prefix->lo = 0;
+    } else if (prefix_len < 128) {
+        prefix->hi = key->hi;
+        prefix->lo = key->lo & ~(~0ULL >> (prefix_len - 64));
+    } else {
+        *prefix = *key;
+    }
+}
+
+static inline uint64_t ub4j_addr_key_hash(const struct ub4j_addr_key* key) {
+    // Mix both words with the finalizer from MurmurHash3
+    uint64_t h = key->hi * 0x9e3779b97f4a7c15ULL ^ key->lo;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#endif //UNBOUND4J_ADDRKEY_H
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "admission.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int ub4j_admission_init(struct ub4j_admission* admission, size_t width, uint8_t threshold, uint32_t window_secs,
+                        uint64_t now_ms, char* error, size_t error_len) {
+    memset(admission, 0, sizeof(struct ub4j_admission));
+
+    size_t row_len = 64;
+    while (row_len < width) {
+        row_len <<= 1;
+    }
+    admission->counters = calloc(row_len * UB4J_ADMISSION_ROWS, sizeof(atomic_uchar));
+    if (admission->counters == NULL) {
+        snprintf(error, error_len, "Failed to allocate memory for admission filter.");
+        return -1;
+    }
+    admission->width_mask = row_len - 1;
+    admission->threshold = threshold;
+    admission->window_ms = (uint64_t)window_secs * 1000;
+    admission->window_start_ms = now_ms;
+    return 0;
+}
+
+void ub4j_admission_free(struct ub4j_admission* admission) {
+    free(admission->counters);
+    memset(admission, 0, sizeof(struct ub4j_admission));
+}
+
+size_t ub4j_admission_size(const struct ub4j_admission* admission) {
+    return admission->counters != NULL ? (admission->width_mask + 1) * UB4J_ADMISSION_ROWS * sizeof(atomic_uchar) : 0;
+}
+
+uint64_t ub4j_admission_next_age_ms(const struct ub4j_admission* admission) {
+    return admission->window_start_ms + admission->window_ms;
+}
+
+int ub4j_admission_age(struct ub4j_admission* admission, uint64_t now_ms) {
+    if (now_ms < ub4j_admission_next_age_ms(admission)) {
+        return 0;
+    }
+    admission->window_start_ms = now_ms;
+
+    // Lookups counted while we go may be halved along with the rest, or not at all
+    size_t count = (admission->width_mask + 1) * UB4J_ADMISSION_ROWS;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char value = atomic_load_explicit(&admission->counters[i], memory_order_relaxed);
+        if (value != 0) {
+            atomic_store_explicit(&admission->counters[i], (unsigned char)(value >> 1), memory_order_relaxed);
+        }
+    }
+    return 1;
+}
+
+int ub4j_admission_record(struct ub4j_admission* admission, const struct ub4j_addr_key* key) {
+    // Pick a counter in every row by double hashing
+    uint64_t hash = ub4j_addr_key_hash(key);
+    uint64_t step = (hash >> 32) | 1;
+    atomic_uchar* counters[UB4J_ADMISSION_ROWS];
+    unsigned char estimate = UCHAR_MAX;
+    for (int row = 0; row < UB4J_ADMISSION_ROWS; row++) {
+        counters[row] = &admission->counters[(size_t)row * (admission->width_mask + 1) + ((hash + row * step) & admission->width_mask)];
+        unsigned char value = atomic_load_explicit(counters[row], memory_order_relaxed);
+        if (value < estimate) {
+            estimate = value;
+        }
+    }
+
+    // Only bump the counters that hold the minimum (conservative update), which keeps the
+    // addresses that share counters with busier ones from being overestimated as much
+    if (estimate < UCHAR_MAX) {
+        for (int row = 0; row < UB4J_ADMISSION_ROWS; row++) {
+            unsigned char value = estimate;
+            atomic_compare_exchange_strong_explicit(counters[row], &value, (unsigned char)(estimate + 1), memory_order_relaxed, memory_order_relaxed);
+        }
+        estimate++;
+    }
+    return estimate >= admission->threshold;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UNBOUND4J_ADMISSION_H
+#define UNBOUND4J_ADMISSION_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addrkey.h"
+
+/*
+ * Keeps addresses that are only seen once or twice, i.e. those of port scans and spoofed floods, from
+ * taking up queries, in-flight slots and cache entries. Lookups are counted in a count-min sketch, and
+ * an address is only admitted once its estimated count reaches the threshold. Every window, all of the
+ * counts are halved so that addresses have to keep being seen to stay admitted, as in TinyLFU.
+ *
+ * The sketch has a fixed size, no matter how many distinct addresses it sees. Estimates can only be too
+ * high, so a crowded sketch lets more addresses in, never fewer.
+ */
+
+#define UB4J_ADMISSION_ROWS 4
+
+struct ub4j_admission {
+    atomic_uchar* counters; // UB4J_ADMISSION_ROWS rows of width counters, saturating at 255
+    size_t width_mask;
+    uint8_t threshold;
+    uint64_t window_ms;
+    uint64_t window_start_ms; // only used by the thread that ages the sketch
+};
+
+/**
+ * @param width number of counters in each row, rounded up to a power of two
+ * @return 0 on success, or -1 with the error filled in
+ */
+int ub4j_admission_init(struct ub4j_admission* admission, size_t width, uint8_t threshold, uint32_t window_secs,
+                        uint64_t now_ms, char* error, size_t error_len);
+
+void ub4j_admission_free(struct ub4j_admission* admission);
+
+/**
+ * Counts a lookup for the address.
+ *
+ * @return 1 if the address has now been seen often enough to be resolved, 0 otherwise
+ */
+int ub4j_admission_record(struct ub4j_admission* admission, const struct ub4j_addr_key* key);
+
+/**
+ * Halves every count if the window is over. This goes over the whole sketch, so it's kept off the
+ * lookup path, and left to a single background thread that calls it by the time returned by
+ * ub4j_admission_next_age_ms().
+ *
+ * @return 1 if the counts were halved, 0 otherwise
+ */
+int ub4j_admission_age(struct ub4j_admission* admission, uint64_t now_ms);
+
+/**
+ * @return the time at which the current window ends
+ */
+uint64_t ub4j_admission_next_age_ms(const struct ub4j_admission* admission);
+
+/**
+ * @return the number of bytes used by the sketch
+ */
+size_t ub4j_admission_size(const struct ub4j_admission* admission);
+
+#endif //UNBOUND4J_ADMISSION_H
@@ -0,0 +1,448 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeutils.h"
+
+static inline size_t set_index(struct ub4j_cache* cache, const struct ub4j_addr_key* key) {
+    return (size_t)ub4j_addr_key_hash(key) & cache->set_mask;
+}
+
+static inline pthread_mutex_t* set_lock(struct ub4j_cache* cache, size_t set) {
+    return &cache->stripes[set & cache->stripe_mask].lock;
+}
+
+static inline int can_be_stale(enum ub4j_cache_outcome outcome) {
+    // Failures are only worth remembering for as long as their TTL
+    return outcome == UB4J_CACHE_HOSTNAME || outcome == UB4J_CACHE_NO_DATA;
+}
+
+/**
+ * @return the number of bytes accounted for a hostname held on the heap, 0 for NULL
+ */
+static inline uint64_t heap_hostname_len(const char* hostname) {
+    return hostname != NULL ? strlen(hostname) + 1 : 0;
+}
+
+static void release_hostname(struct ub4j_cache* cache, char* hostname) {
+    if (hostname != NULL) {
+        atomic_fetch_sub_explicit(&cache->hostname_bytes, heap_hostname_len(hostname), memory_order_relaxed);
+        free(hostname);
+    }
+}
+
+/**
+ * @return the time until which the entry can be returned, stale or not
+ */
+static inline uint64_t usable_until_ms(struct ub4j_cache* cache, struct ub4j_cache_entry* entry) {
+    if (entry->expires_ms == 0 || cache->max_stale_secs == 0 || !can_be_stale(entry->outcome)) {
+        return entry->expires_ms;
+    }
+    return entry->expires_ms + (uint64_t)cache->max_stale_secs * 1000;
+}
+
+int ub4j_cache_init(struct ub4j_cache* cache, size_t capacity, uint32_t max_ttl_secs) {
+    memset(cache, 0, sizeof(struct ub4j_cache));
+
+    size_t sets = 1;
+    while (sets * UB4J_CACHE_WAYS < capacity) {
+        sets <<= 1;
+    }
+    size_t stripes = sets < UB4J_CACHE_MAX_STRIPES ? sets : UB4J_CACHE_MAX_STRIPES;
+
+    cache->entries = calloc(sets * UB4J_CACHE_WAYS, sizeof(struct ub4j_cache_entry));
+    cache->stripes = calloc(stripes, sizeof(union ub4j_cache_stripe));
+    if (cache->entries == NULL || cache->stripes == NULL) {
+        free(cache->entries);
+        free(cache->stripes);
+        memset(cache, 0, sizeof(struct ub4j_cache));
+        return -1;
+    }
+
+    for (size_t i = 0; i < stripes; i++) {
+        pthread_mutex_init(&cache->stripes[i].lock, NULL);
+    }
+    cache->set_mask = sets - 1;
+    cache->stripe_mask = stripes - 1;
+    cache->max_ttl_secs = max_ttl_secs;
+    cache->max_hostname_bytes = UINT64_MAX;
+    atomic_init(&cache->allocations, 0);
+    atomic_init(&cache->hostname_bytes, 0);
+    return 0;
+}
+
+void ub4j_cache_free(struct ub4j_cache* cache) {
+    if (cache->entries == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < (cache->set_mask + 1) * UB4J_CACHE_WAYS; i++) {
+        struct ub4j_cache_entry* entry = &cache->entries[i];
+        if (entry->hostname != entry->inline_hostname) {
+            free(entry->hostname);
+        }
+    }
+    for (size_t i = 0; i <= cache->stripe_mask; i++) {
+        pthread_mutex_destroy(&cache->stripes[i].lock);
+    }
+    free(cache->entries);
+    free(cache->stripes);
+    memset(cache, 0, sizeof(struct ub4j_cache));
+}
+
+enum ub4j_cache_outcome ub4j_cache_get(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms, char* hostname, size_t hostname_len,
+                                       int* flags) {
+    size_t set = set_index(cache, key);
+    struct ub4j_cache_entry* entries = &cache->entries[set * UB4J_CACHE_WAYS];
+    enum ub4j_cache_outcome outcome = UB4J_CACHE_MISS;
+
+    pthread_mutex_t* lock = set_lock(cache, set);
+    pthread_mutex_lock(lock);
+    for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+        struct ub4j_cache_entry* entry = &entries[i];
+        if (usable_until_ms(cache, entry) > now_ms && ub4j_addr_key_equals(&entry->key, key)) {
+            entry->last_used_ms = now_ms;
+            if (entry->hits < UINT32_MAX) {
+                entry->hits++;
+            }
+            if (entry->hostname != NULL) {
+                snprintf(hostname, hostname_len, "%s", entry->hostname);
+            }
+            if (flags != NULL) {
+                int stale = entry->expires_ms <= now_ms;
+                *flags = stale ? UB4J_CACHE_FLAG_STALE : 0;
+                if (entry->refresh_ms != 0 && entry->refresh_ms <= now_ms && (stale || entry->hits >= cache->refresh_min_hits)) {
+                    *flags |= UB4J_CACHE_FLAG_REFRESH;
+                }
+            }
+            outcome = entry->outcome;
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return outcome;
+}
+
+void ub4j_cache_put(struct ub4j_cache* cache, const struct ub4j_addr_key* key, enum ub4j_cache_outcome outcome,
+                    const char* hostname, uint32_t ttl_secs, uint64_t now_ms) {
+    if (ttl_secs > cache->max_ttl_secs) {
+        ttl_secs = cache->max_ttl_secs;
+    }
+    if (ttl_secs == 0) {
+        return;
+    }
+
+    // Names that don't fit in the entry are copied before grabbing the lock
+    size_t hostname_len = outcome == UB4J_CACHE_HOSTNAME ? strlen(hostname) + 1 : 0;
+    char* copy = NULL;
+    if (hostname_len > UB4J_CACHE_INLINE_HOSTNAME_LEN) {
+        copy = strdup(hostname);
+        if (copy == NULL) {
+            return;
+        }
+        atomic_fetch_add_explicit(&cache->allocations, 1, memory_order_relaxed);
+    }
+
+    size_t set = set_index(cache, key);
+    struct ub4j_cache_entry* entries = &cache->entries[set * UB4J_CACHE_WAYS];
+
+    pthread_mutex_t* lock = set_lock(cache, set);
+    pthread_mutex_lock(lock);
+
+    // Reuse the entry for the same address if there is one, otherwise pick a free or
+    // expired entry, and fall back to the least recently used one
+    struct ub4j_cache_entry* victim = NULL;
+    for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+        struct ub4j_cache_entry* entry = &entries[i];
+        if (entry->expires_ms != 0 && ub4j_addr_key_equals(&entry->key, key)) {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || (usable_until_ms(cache, victim) > now_ms &&
+                (usable_until_ms(cache, entry) <= now_ms || entry->last_used_ms < victim->last_used_ms))) {
+            victim = entry;
+        }
+    }
+
+    char* previous = victim->hostname != victim->inline_hostname ? victim->hostname : NULL;
+    char* evicted[UB4J_CACHE_WAYS];
+    int evicted_count = 0;
+    if (copy != NULL) {
+        uint64_t used = atomic_fetch_add_explicit(&cache->hostname_bytes, hostname_len, memory_order_relaxed) + hostname_len;
+        uint64_t released = heap_hostname_len(previous);
+        if (used - released > cache->max_hostname_bytes) {
+            // Only evict if that makes enough room
+            uint64_t releasable = released;
+            for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+                if (&entries[i] != victim) {
+                    releasable += heap_hostname_len(entries[i].hostname != entries[i].inline_hostname ? entries[i].hostname : NULL);
+                }
+            }
+            if (used - releasable > cache->max_hostname_bytes) {
+                pthread_mutex_unlock(lock);
+                free(copy);
+                atomic_fetch_sub_explicit(&cache->hostname_bytes, hostname_len, memory_order_relaxed);
+                return;
+            }
+            while (used - released > cache->max_hostname_bytes) {
+                struct ub4j_cache_entry* lru = NULL;
+                for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+                    struct ub4j_cache_entry* entry = &entries[i];
+                    if (entry != victim && entry->hostname != NULL && entry->hostname != entry->inline_hostname &&
+                        (lru == NULL || entry->last_used_ms < lru->last_used_ms)) {
+                        lru = entry;
+                    }
+                }
+                released += heap_hostname_len(lru->hostname);
+                evicted[evicted_count++] = lru->hostname;
+                lru->hostname = NULL;
+                lru->outcome = UB4J_CACHE_MISS;
+                lru->expires_ms = 0;
+            }
+        }
+    }
+
+    victim->key = *key;
+    victim->outcome = outcome;
+    if (copy != NULL) {
+        victim->hostname = copy;
+    } else if (hostname_len > 0) {
+        memcpy(victim->inline_hostname, hostname, hostname_len);
+        victim->hostname = victim->inline_hostname;
+    } else {
+        victim->hostname = NULL;
+    }
+    victim->expires_ms = now_ms + (uint64_t)ttl_secs * 1000;
+    victim->last_used_ms = now_ms;
+    if (cache->refresh_percent > 0) {
+        victim->refresh_ms = now_ms + (uint64_t)ttl_secs * 10 * (uint64_t)cache->refresh_percent;
+    } else {
+        // Stale entries are always refreshed
+        victim->refresh_ms = cache->max_stale_secs > 0 ? victim->expires_ms : 0;
+    }
+    victim->hits = 0;
+    pthread_mutex_unlock(lock);
+
+    release_hostname(cache, previous);
+    for (int i = 0; i < evicted_count; i++) {
+        release_hostname(cache, evicted[i]);
+    }
+}
+
+void ub4j_cache_enable_refresh(struct ub4j_cache* cache, int percent, uint32_t min_hits) {
+    cache->refresh_percent = percent;
+    cache->refresh_min_hits = min_hits;
+}
+
+void ub4j_cache_enable_stale(struct ub4j_cache* cache, uint32_t max_stale_secs) {
+    cache->max_stale_secs = max_stale_secs;
+}
+
+void ub4j_cache_limit_hostnames(struct ub4j_cache* cache, uint64_t max_bytes) {
+    cache->max_hostname_bytes = max_bytes;
+}
+
+size_t ub4j_cache_size(const struct ub4j_cache* cache) {
+    if (cache->entries == NULL) {
+        return 0;
+    }
+    return (cache->set_mask + 1) * UB4J_CACHE_WAYS * sizeof(struct ub4j_cache_entry) +
+           (cache->stripe_mask + 1) * sizeof(union ub4j_cache_stripe);
+}
+
+int ub4j_cache_claim_refresh(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms) {
+    size_t set = set_index(cache, key);
+    struct ub4j_cache_entry* entries = &cache->entries[set * UB4J_CACHE_WAYS];
+    int claimed = 0;
+
+    pthread_mutex_t* lock = set_lock(cache, set);
+    pthread_mutex_lock(lock);
+    for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+        struct ub4j_cache_entry* entry = &entries[i];
+        if (usable_until_ms(cache, entry) > now_ms && ub4j_addr_key_equals(&entry->key, key)) {
+            claimed = entry->refresh_ms != 0;
+            entry->refresh_ms = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return claimed;
+}
+
+void ub4j_cache_defer_refresh(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t refresh_ms, uint64_t now_ms) {
+    size_t set = set_index(cache, key);
+    struct ub4j_cache_entry* entries = &cache->entries[set * UB4J_CACHE_WAYS];
+
+    pthread_mutex_t* lock = set_lock(cache, set);
+    pthread_mutex_lock(lock);
+    for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+        struct ub4j_cache_entry* entry = &entries[i];
+        if (usable_until_ms(cache, entry) > now_ms && ub4j_addr_key_equals(&entry->key, key)) {
+            if (entry->refresh_ms == 0) {
+                entry->refresh_ms = refresh_ms;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/*
+ * Snapshots are made up of a header followed by one record per entry, with:
+ *  - the key, as two uint64_t
+ *  - the expiry time in milliseconds since the epoch, as a uint64_t
+ *  - the outcome, and the length of the hostname, as a byte each
+ *  - the hostname, without the terminating null
+ *
+ * Numbers are stored in the byte order of the host, snapshots are not meant to be moved between hosts.
+ */
+
+#define SNAPSHOT_MAGIC "UB4JCSN1"
+#define SNAPSHOT_BYTE_ORDER 0x01020304U
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+};
+
+struct snapshot_record {
+    struct ub4j_addr_key key;
+    uint64_t expires_unix_ms;
+    uint8_t outcome;
+    uint8_t hostname_len;
+};
+
+long ub4j_cache_save(struct ub4j_cache* cache, const char* path, uint64_t now_ms, char* error, size_t error_len) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        snprintf(error, error_len, "Failed to open %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.version = SNAPSHOT_VERSION;
+    int failed = fwrite(&header, sizeof(header), 1, out) != 1;
+
+    uint64_t unix_ms = ub4j_realtime_ms();
+    long count = 0;
+    for (size_t set = 0; set <= cache->set_mask && !failed; set++) {
+        // Copy the set out so that we don't hold the lock while writing
+        struct ub4j_cache_entry* entries = &cache->entries[set * UB4J_CACHE_WAYS];
+        struct snapshot_record records[UB4J_CACHE_WAYS];
+        char hostnames[UB4J_CACHE_WAYS][256];
+        int num_records = 0;
+
+        pthread_mutex_t* lock = set_lock(cache, set);
+        pthread_mutex_lock(lock);
+        for (int i = 0; i < UB4J_CACHE_WAYS; i++) {
+            struct ub4j_cache_entry* entry = &entries[i];
+            size_t hostname_len = entry->hostname != NULL ? strlen(entry->hostname) : 0;
+            if (entry->expires_ms <= now_ms || hostname_len >= sizeof(hostnames[0]) ||
+                (entry->outcome == UB4J_CACHE_HOSTNAME && hostname_len == 0)) {
+                continue;
+            }
+            struct snapshot_record* record = &records[num_records];
+            record->key = entry->key;
+            record->expires_unix_ms = unix_ms + (entry->expires_ms - now_ms);
+            record->outcome = (uint8_t)entry->outcome;
+            record->hostname_len = (uint8_t)hostname_len;
+            memcpy(hostnames[num_records], entry->hostname != NULL ? entry->hostname : "", hostname_len);
+            num_records++;
+        }
+        pthread_mutex_unlock(lock);
+
+        for (int i = 0; i < num_records && !failed; i++) {
+            failed = fwrite(&records[i].key, sizeof(struct ub4j_addr_key), 1, out) != 1 ||
+                     fwrite(&records[i].expires_unix_ms, sizeof(uint64_t), 1, out) != 1 ||
+                     fwrite(&records[i].outcome, 1, 1, out) != 1 ||
+                     fwrite(&records[i].hostname_len, 1, 1, out) != 1 ||
+                     fwrite(hostnames[i], 1, records[i].hostname_len, out) != records[i].hostname_len;
+            count++;
+        }
+    }
+
+    if (fclose(out) != 0 || failed) {
+        snprintf(error, error_len, "Failed to write %s: %s", tmp_path, strerror(errno));
+        remove(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, path) != 0) {
+        snprintf(error, error_len, "Failed to rename %s to %s: %s", tmp_path, path, strerror(errno));
+        remove(tmp_path);
+        return -1;
+    }
+    return count;
+}
+
+long ub4j_cache_load(struct ub4j_cache* cache, const char* path, uint64_t now_ms, char* error, size_t error_len) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        snprintf(error, error_len, "Failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct snapshot_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != SNAPSHOT_BYTE_ORDER || header.version != SNAPSHOT_VERSION) {
+        fclose(in);
+        snprintf(error, error_len, "Invalid cache snapshot %s: bad header.", path);
+        return -1;
+    }
+
+    uint64_t unix_ms = ub4j_realtime_ms();
+    long count = 0;
+    struct snapshot_record record;
+    char hostname[256];
+    while (fread(&record.key, sizeof(struct ub4j_addr_key), 1, in) == 1) {
+        if (fread(&record.expires_unix_ms, sizeof(uint64_t), 1, in) != 1 || fread(&record.outcome, 1, 1, in) != 1 ||
+            fread(&record.hostname_len, 1, 1, in) != 1 ||
+            fread(hostname, 1, record.hostname_len, in) != record.hostname_len ||
+            record.outcome < UB4J_CACHE_HOSTNAME || record.outcome > UB4J_CACHE_TIMEOUT ||
+            (record.outcome == UB4J_CACHE_HOSTNAME) != (record.hostname_len > 0)) {
+            fclose(in);
+            snprintf(error, error_len, "Invalid cache snapshot %s: truncated or bad record.", path);
+            return -1;
+        }
+        hostname[record.hostname_len] = '\0';
+
+        // Entries are only kept for whole seconds, anything with less than that left is dropped
+        if (record.expires_unix_ms > unix_ms) {
+            uint64_t ttl_secs = (record.expires_unix_ms - unix_ms) / 1000;
+            if (ttl_secs > 0) {
+                ub4j_cache_put(cache, &record.key, (enum ub4j_cache_outcome)record.outcome, hostname,
+                               ttl_secs < UINT32_MAX ? (uint32_t)ttl_secs : UINT32_MAX, now_ms);
+                count++;
+            }
+        }
+    }
+    fclose(in);
+    return count;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_CACHE_H
+#define UNBOUND4J_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addrkey.h"
+
+/*
+ * Fixed-capacity cache of reverse lookup results, keyed by address.
+ *
+ * Entries are organized in sets of UB4J_CACHE_WAYS; an address can only live in the set
+ * its hash maps to, and the least recently used entry of that set is evicted to make room.
+ * Sets are guarded by a fixed number of striped locks, so lookups for different addresses
+ * rarely contend with each other. Entries expire according to the TTL of the record.
+ *
+ * Negative outcomes are cached alongside the hostnames, so that addresses without a PTR record,
+ * or with broken delegations, don't go back to the network on every lookup.
+ */
+
+#define UB4J_CACHE_WAYS 4
+#define UB4J_CACHE_MAX_STRIPES 256
+// Hostnames up to this length (including the terminating null) are stored in the entries
+// themselves, which covers nearly all PTR records. Longer ones are copied to the heap.
+#define UB4J_CACHE_INLINE_HOSTNAME_LEN 80
+
+enum ub4j_cache_outcome {
+    UB4J_CACHE_MISS = 0,
+    UB4J_CACHE_HOSTNAME,
+    UB4J_CACHE_NO_DATA,     // NXDOMAIN, or no PTR record for the name
+    UB4J_CACHE_SERVFAIL,    // SERVFAIL, or any other error rcode
+    UB4J_CACHE_TIMEOUT      // our own request timeout
+};
+
+// Flags set by ub4j_cache_get()
+#define UB4J_CACHE_FLAG_REFRESH 1 // the entry is due for a refresh, see ub4j_cache_claim_refresh()
+#define UB4J_CACHE_FLAG_STALE 2   // the entry has expired, but is still within the maximum staleness
+
+struct ub4j_cache_entry {
+    struct ub4j_addr_key key;
+    uint64_t expires_ms; // 0 when the entry is free
+    uint64_t last_used_ms;
+    uint64_t refresh_ms; // when the entry becomes eligible for a refresh, 0 once claimed or if refreshes are disabled
+    uint32_t hits; // since the entry was stored
+    enum ub4j_cache_outcome outcome;
+    char* hostname; // only set for UB4J_CACHE_HOSTNAME, points to inline_hostname or the heap
+    char inline_hostname[UB4J_CACHE_INLINE_HOSTNAME_LEN];
+};
+
+union ub4j_cache_stripe {
+    pthread_mutex_t lock;
+    char pad[64]; // keep every lock on its own cache line
+};
+
+struct ub4j_cache {
+    struct ub4j_cache_entry* entries;
+    size_t set_mask;
+    union ub4j_cache_stripe* stripes;
+    size_t stripe_mask;
+    uint32_t max_ttl_secs;
+    int refresh_percent; // of the TTL after which hot entries are refreshed, 0 when disabled
+    uint32_t refresh_min_hits;
+    uint32_t max_stale_secs; // how long expired entries are kept around to be served stale, 0 when disabled
+    atomic_ullong allocations; // hostnames that were too long to be stored inline
+    atomic_ullong hostname_bytes; // held by those hostnames
+    uint64_t max_hostname_bytes;
+};
+
+int ub4j_cache_init(struct ub4j_cache* cache, size_t capacity, uint32_t max_ttl_secs);
+
+void ub4j_cache_free(struct ub4j_cache* cache);
+
+/**
+ * Looks up the cached outcome for the given address, copying the hostname into the buffer
+ * if there is one. When flags isn't NULL, it's set to a combination of the UB4J_CACHE_FLAG_* flags.
+ *
+ * @return the cached outcome, or UB4J_CACHE_MISS
+ */
+enum ub4j_cache_outcome ub4j_cache_get(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms, char* hostname, size_t hostname_len,
+                                       int* flags);
+
+/**
+ * Stores the outcome for the given address for ttl_secs, capped to the configured maximum.
+ * The hostname is only used with UB4J_CACHE_HOSTNAME. Nothing is stored if the TTL is 0.
+ */
+void ub4j_cache_put(struct ub4j_cache* cache, const struct ub4j_addr_key* key, enum ub4j_cache_outcome outcome,
+                    const char* hostname, uint32_t ttl_secs, uint64_t now_ms);
+
+/**
+ * Makes entries that were hit at least min_hits times eligible for a refresh once the given percentage of
+ * their TTL has elapsed, see ub4j_cache_get(). Must be called before the cache is used.
+ */
+void ub4j_cache_enable_refresh(struct ub4j_cache* cache, int percent, uint32_t min_hits);
+
+/**
+ * Keeps hostnames and the absence of one for up to max_stale_secs past their expiry. They're then returned
+ * with UB4J_CACHE_FLAG_STALE, and are always due for a refresh. Must be called before the cache is used.
+ */
+void ub4j_cache_enable_stale(struct ub4j_cache* cache, uint32_t max_stale_secs);
+
+/**
+ * Bounds the memory held by hostnames that are too long to be stored inline. Once it's reached, storing another
+ * one evicts entries of the same set that hold one, least recently used first, and the address is left uncached
+ * if that doesn't free enough. Unbounded by default. Must be called before the cache is used.
+ */
+void ub4j_cache_limit_hostnames(struct ub4j_cache* cache, uint64_t max_bytes);
+
+/**
+ * @return the number of bytes allocated for the entries, which doesn't include the hostnames held on the heap
+ */
+size_t ub4j_cache_size(const struct ub4j_cache* cache);
+
+/**
+ * Claims the refresh of an entry that ub4j_cache_get() found to be due, so that only one
+ * caller refreshes it.
+ *
+ * @return 1 if the refresh was claimed, 0 if someone else got to it first or the entry is gone
+ */
+int ub4j_cache_claim_refresh(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms);
+
+/**
+ * Makes an entry whose refresh was claimed, but failed, due again at the given time.
+ */
+void ub4j_cache_defer_refresh(struct ub4j_cache* cache, const struct ub4j_addr_key* key, uint64_t refresh_ms, uint64_t now_ms);
+
+/**
+ * Writes the entries that haven't expired to the given file, replacing it atomically. Expiry times are
+ * stored on the wall clock so that the snapshot can be loaded by another process, see ub4j_cache_load().
+ *
+ * @return the number of entries written, or -1 with the error filled in
+ */
+long ub4j_cache_save(struct ub4j_cache* cache, const char* path, uint64_t now_ms, char* error, size_t error_len);
+
+/**
+ * Adds the entries of a snapshot written by ub4j_cache_save() to the cache, dropping those that have since expired.
+ *
+ * @return the number of entries loaded, or -1 with the error filled in; a missing file loads nothing
+ */
+long ub4j_cache_load(struct ub4j_cache* cache, const char* path, uint64_t now_ms, char* error, size_t error_len);
+
+#endif //UNBOUND4J_CACHE_H
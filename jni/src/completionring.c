@@ -0,0 +1,139 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "completionring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+int ub4j_ring_init(struct ub4j_completion_ring* ring, size_t capacity) {
+    memset(ring, 0, sizeof(struct ub4j_completion_ring));
+
+    size_t actual = 4096;
+    while (actual < capacity) {
+        actual <<= 1;
+    }
+    ring->buffer = calloc(actual, 1);
+    if (ring->buffer == NULL) {
+        return -1;
+    }
+    ring->capacity = actual;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&ring->lock, NULL) != 0 || pthread_cond_init(&ring->readable, &attr) != 0) {
+        pthread_condattr_destroy(&attr);
+        free(ring->buffer);
+        ring->buffer = NULL;
+        return -1;
+    }
+    pthread_condattr_destroy(&attr);
+    return 0;
+}
+
+void ub4j_ring_free(struct ub4j_completion_ring* ring) {
+    if (ring->buffer == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&ring->readable);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->buffer);
+    memset(ring, 0, sizeof(struct ub4j_completion_ring));
+}
+
+static inline void put_int32(uint8_t* p, int32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void put_int64(uint8_t* p, int64_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+int ub4j_ring_put(struct ub4j_completion_ring* ring, int64_t id, int status, const char* text) {
+    size_t text_len = text != NULL ? strlen(text) : 0;
+    size_t record_len = ALIGN8(UB4J_RING_HEADER_LEN + text_len);
+
+    pthread_mutex_lock(&ring->lock);
+
+    size_t offset = (size_t)(ring->write_pos & (ring->capacity - 1));
+    size_t tail_len = ring->capacity - offset;
+    size_t padding_len = record_len > tail_len ? tail_len : 0;
+    size_t free_len = ring->capacity - (size_t)(ring->write_pos - ring->read_pos);
+    if (padding_len + record_len > free_len) {
+        pthread_mutex_unlock(&ring->lock);
+        return -1;
+    }
+
+    if (padding_len > 0) {
+        // Skip over the tail of the buffer
+        put_int32(ring->buffer + offset, (int32_t)padding_len);
+        put_int32(ring->buffer + offset + 4, UB4J_RING_PADDING);
+        ring->write_pos += padding_len;
+        offset = 0;
+    }
+
+    uint8_t* record = ring->buffer + offset;
+    put_int32(record, (int32_t)record_len);
+    put_int32(record + 4, status);
+    put_int64(record + 8, id);
+    put_int32(record + 16, text != NULL ? (int32_t)text_len : -1);
+    put_int32(record + 20, 0);
+    if (text_len > 0) {
+        memcpy(record + UB4J_RING_HEADER_LEN, text, text_len);
+    }
+    ring->write_pos += record_len;
+
+    if (ring->consumer_waiting) {
+        pthread_cond_signal(&ring->readable);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return 0;
+}
+
+uint64_t ub4j_ring_poll(struct ub4j_completion_ring* ring, uint64_t consumed, int timeout_ms) {
+    pthread_mutex_lock(&ring->lock);
+    if (consumed > ring->read_pos && consumed <= ring->write_pos) {
+        ring->read_pos = consumed;
+    }
+
+    if (ring->write_pos == consumed && timeout_ms > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        ring->consumer_waiting = 1;
+        while (ring->write_pos == consumed) {
+            if (pthread_cond_timedwait(&ring->readable, &ring->lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        ring->consumer_waiting = 0;
+    }
+
+    uint64_t write_pos = ring->write_pos;
+    pthread_mutex_unlock(&ring->lock);
+    return write_pos;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_COMPLETIONRING_H
+#define UNBOUND4J_COMPLETIONRING_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ring buffer of completed lookups, shared with Java as a direct ByteBuffer.
+ *
+ * Any thread can write records to the ring. A single consumer reads them in bulk, and
+ * uses ub4j_ring_poll() both to release the space it has consumed and to wait for more.
+ * Positions only ever increase, the offset in the buffer being the position modulo the
+ * capacity. Records are laid out in native byte order as follows:
+ *
+ *   int32 length    total length of the record, a multiple of 8
+ *   int32 status    status of the lookup, or UB4J_RING_PADDING
+ *   int64 id        the id the lookup was submitted with
+ *   int32 text_len  length of the hostname that follows, or -1 if there is none
+ *   int32 unused
+ *   text            the hostname
+ *
+ * Records never wrap around the end of the buffer. When one doesn't fit, the tail of the
+ * buffer is filled with a padding record, of which only the length and status are set.
+ */
+
+#define UB4J_RING_PADDING -1
+
+#define UB4J_RING_HEADER_LEN 24
+
+struct ub4j_completion_ring {
+    uint8_t* buffer;
+    size_t capacity; // a power of 2
+    uint64_t write_pos;
+    uint64_t read_pos;
+    short consumer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t readable;
+};
+
+int ub4j_ring_init(struct ub4j_completion_ring* ring, size_t capacity);
+
+void ub4j_ring_free(struct ub4j_completion_ring* ring);
+
+/**
+ * Writes a record to the ring.
+ *
+ * @return 0 on success, or -1 if there isn't enough space left in the ring
+ */
+int ub4j_ring_put(struct ub4j_completion_ring* ring, int64_t id, int status, const char* text);
+
+/**
+ * Releases the space used by the records before the consumed position, and waits for up to timeout_ms
+ * for records past that position to be available.
+ *
+ * @return the position up to which records can be read
+ */
+uint64_t ub4j_ring_poll(struct ub4j_completion_ring* ring, uint64_t consumed, int timeout_ms);
+
+#endif //UNBOUND4J_COMPLETIONRING_H
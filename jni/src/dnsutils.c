@@ -23,37 +23,179 @@
  * Adapted from ./smallapp/unbound-host.c in the Unbound source tree.
  *
  * @param addr
- * @param res
+ * @param buf buffer the domain is written to, REVERSE_LOOKUP_DOMAIN_MAX_LEN bytes is always enough
+ * @param buf_len length of the buffer
  */
-void build_reverse_lookup_domain_v4(struct in_addr* addr, char** res) {
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%u.%u.%u.%u.in-addr.arpa",
-             (unsigned)((uint8_t*)addr)[3], (unsigned)((uint8_t*)addr)[2],
-             (unsigned)((uint8_t*)addr)[1], (unsigned)((uint8_t*)addr)[0]);
-    *res = strdup(buf);
+void build_reverse_lookup_domain_v4(const struct in_addr* addr, char* buf, size_t buf_len) {
+    snprintf(buf, buf_len, "%u.%u.%u.%u.in-addr.arpa",
+             (unsigned)((const uint8_t*)addr)[3], (unsigned)((const uint8_t*)addr)[2],
+             (unsigned)((const uint8_t*)addr)[1], (unsigned)((const uint8_t*)addr)[0]);
 }
 
 /**
  * Adapted from ./smallapp/unbound-host.c in the Unbound source tree.
  *
  * @param addr
- * @param res
+ * @param buf buffer the domain is written to, REVERSE_LOOKUP_DOMAIN_MAX_LEN bytes is always enough
+ * @param buf_len length of the buffer
  */
-void build_reverse_lookup_domain_v6(struct in6_addr* addr, char** res) {
+void build_reverse_lookup_domain_v6(const struct in6_addr* addr, char* buf, size_t buf_len) {
     /* [nibble.]{32}.ip6.arpa. is less than 128 */
     const char* hex = "0123456789abcdef";
-    char buf[128];
     char *p;
     int i;
 
+    if (buf_len < REVERSE_LOOKUP_DOMAIN_MAX_LEN) {
+        if (buf_len > 0) {
+            buf[0] = '\0';
+        }
+        return;
+    }
+
     p = buf;
     for(i=15; i>=0; i--) {
-        uint8_t b = ((uint8_t*)addr)[i];
+        uint8_t b = ((const uint8_t*)addr)[i];
         *p++ = hex[ (b&0x0f) ];
         *p++ = '.';
         *p++ = hex[ (b&0xf0) >> 4 ];
         *p++ = '.';
     }
-    snprintf(buf+16*4, sizeof(buf)-16*4, "ip6.arpa");
-    *res = strdup(buf);
+    snprintf(buf+16*4, buf_len-16*4, "ip6.arpa");
+}
+
+/**
+ * Skips over the (possibly compressed) domain name at the given offset.
+ *
+ * @return the offset following the name, or 0 if the name is malformed
+ */
+static size_t skip_name(const uint8_t* packet, size_t packet_len, size_t offset) {
+    while (offset < packet_len) {
+        uint8_t len = packet[offset];
+        if (len == 0) {
+            return offset + 1;
+        } else if ((len & 0xc0) == 0xc0) {
+            // Compression pointer, the name ends here
+            return offset + 2 <= packet_len ? offset + 2 : 0;
+        } else if ((len & 0xc0) != 0) {
+            return 0;
+        }
+        offset += 1 + len;
+    }
+    return 0;
+}
+
+static uint32_t read_uint32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/**
+ * Looks for an SOA record in the authority section of the given DNS message.
+ *
+ * @param record_ttl set to the TTL of the record
+ * @param rdata set to the offset of the record's data
+ * @param rdata_len set to the length of the record's data
+ * @return the offset of the record's owner name, or 0 if there is no SOA record
+ */
+static size_t find_soa_record(const uint8_t* packet, size_t packet_len, uint32_t* record_ttl, size_t* rdata, size_t* rdata_len) {
+    if (packet == NULL || packet_len < 12) {
+        return 0;
+    }
+
+    unsigned qdcount = ((unsigned)packet[4] << 8) | packet[5];
+    unsigned ancount = ((unsigned)packet[6] << 8) | packet[7];
+    unsigned nscount = ((unsigned)packet[8] << 8) | packet[9];
+
+    // Skip the question section, each entry has a name, a type and a class
+    size_t offset = 12;
+    for (unsigned i = 0; i < qdcount; i++) {
+        offset = skip_name(packet, packet_len, offset);
+        if (offset == 0 || offset + 4 > packet_len) {
+            return 0;
+        }
+        offset += 4;
+    }
+
+    // Walk the answer and authority sections, each record has a name, type, class, TTL, rdata length and rdata
+    for (unsigned i = 0; i < ancount + nscount; i++) {
+        size_t owner = offset;
+        offset = skip_name(packet, packet_len, offset);
+        if (offset == 0 || offset + 10 > packet_len) {
+            return 0;
+        }
+        unsigned type = ((unsigned)packet[offset] << 8) | packet[offset + 1];
+        *record_ttl = read_uint32(packet + offset + 4);
+        *rdata_len = ((size_t)packet[offset + 8] << 8) | packet[offset + 9];
+        offset += 10;
+        if (offset + *rdata_len > packet_len) {
+            return 0;
+        }
+
+        if (i >= ancount && type == 6 /* RR_TYPE_SOA */) {
+            *rdata = offset;
+            return owner;
+        }
+        offset += *rdata_len;
+    }
+    return 0;
+}
+
+/**
+ * Looks for an SOA record in the authority section of the given DNS message and determines
+ * how long the negative answer it came with may be cached for, i.e. the lesser of the
+ * record's TTL and its MINIMUM field (RFC 2308).
+ *
+ * @param packet the DNS message in wire format
+ * @param packet_len length of the message
+ * @param ttl set to the negative TTL, in seconds
+ * @return 0 if an SOA record was found, -1 otherwise
+ */
+int get_negative_ttl_from_soa(const uint8_t* packet, size_t packet_len, uint32_t* ttl) {
+    uint32_t record_ttl;
+    size_t rdata, rdata_len;
+    if (find_soa_record(packet, packet_len, &record_ttl, &rdata, &rdata_len) == 0 || rdata_len < 4) {
+        return -1;
+    }
+
+    // The SOA's MINIMUM field is the last 4 bytes of its rdata
+    uint32_t minimum = read_uint32(packet + rdata + rdata_len - 4);
+    *ttl = record_ttl < minimum ? record_ttl : minimum;
+    return 0;
+}
+
+/**
+ * Counts the labels in the owner name of the SOA record found in the authority section of the
+ * given DNS message, i.e. the apex of the zone that answered. The root has no labels.
+ *
+ * @param labels set to the number of labels
+ * @return 0 if an SOA record was found, -1 otherwise
+ */
+int get_soa_owner_label_count(const uint8_t* packet, size_t packet_len, int* labels) {
+    uint32_t record_ttl;
+    size_t rdata, rdata_len;
+    size_t offset = find_soa_record(packet, packet_len, &record_ttl, &rdata, &rdata_len);
+    if (offset == 0) {
+        return -1;
+    }
+
+    // Follow the compression pointers, bounding the number we follow to guard against loops
+    int count = 0;
+    int jumps = 0;
+    while (offset < packet_len) {
+        uint8_t len = packet[offset];
+        if (len == 0) {
+            *labels = count;
+            return 0;
+        } else if ((len & 0xc0) == 0xc0) {
+            if (offset + 1 >= packet_len || ++jumps > 32) {
+                return -1;
+            }
+            offset = ((size_t)(len & 0x3f) << 8) | packet[offset + 1];
+        } else if ((len & 0xc0) != 0) {
+            return -1;
+        } else {
+            count++;
+            offset += 1 + len;
+        }
+    }
+    return -1;
 }
@@ -18,8 +18,15 @@
 #define UNBOUND4J_DNSUTILS_H
 
 #include <arpa/inet.h>
+#include <stddef.h>
+#include <stdint.h>
 
-void build_reverse_lookup_domain_v4(struct in_addr* addr, char** res);
-void build_reverse_lookup_domain_v6(struct in6_addr* addr, char** res);
+// Large enough for any reverse lookup domain, the longest being those for IPv6 addresses
+#define REVERSE_LOOKUP_DOMAIN_MAX_LEN 128
+
+void build_reverse_lookup_domain_v4(const struct in_addr* addr, char* buf, size_t buf_len);
+void build_reverse_lookup_domain_v6(const struct in6_addr* addr, char* buf, size_t buf_len);
+int get_negative_ttl_from_soa(const uint8_t* packet, size_t packet_len, uint32_t* ttl);
+int get_soa_owner_label_count(const uint8_t* packet, size_t packet_len, int* labels);
 
 #endif //UNBOUND4J_DNSUTILS_H
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define UB4J_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "evloop.h"
+
+int ub4j_evloop_init(struct ub4j_evloop* loop, int watch_fd) {
+    loop->epoll_fd = -1;
+    loop->watch_fd = watch_fd;
+    loop->wake_read_fd = -1;
+    loop->wake_write_fd = -1;
+
+#ifdef UB4J_USE_EPOLL
+    loop->wake_read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_read_fd < 0) {
+        return -1;
+    }
+    loop->wake_write_fd = loop->wake_read_fd;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        ub4j_evloop_free(loop);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = UB4J_EV_READABLE;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, watch_fd, &ev)) {
+        ub4j_evloop_free(loop);
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u32 = UB4J_EV_WOKEN;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_read_fd, &ev)) {
+        ub4j_evloop_free(loop);
+        return -1;
+    }
+#else
+    int fds[2];
+    if (pipe(fds)) {
+        return -1;
+    }
+    loop->wake_read_fd = fds[0];
+    loop->wake_write_fd = fds[1];
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+#endif
+    return 0;
+}
+
+void ub4j_evloop_free(struct ub4j_evloop* loop) {
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    if (loop->wake_write_fd >= 0 && loop->wake_write_fd != loop->wake_read_fd) {
+        close(loop->wake_write_fd);
+    }
+    if (loop->wake_read_fd >= 0) {
+        close(loop->wake_read_fd);
+    }
+    loop->epoll_fd = -1;
+    loop->wake_read_fd = -1;
+    loop->wake_write_fd = -1;
+}
+
+static void drain_wake_fd(struct ub4j_evloop* loop) {
+    uint64_t buf[8];
+    while (read(loop->wake_read_fd, buf, sizeof(buf)) > 0) {
+        // Keep reading until the descriptor is empty
+    }
+}
+
+int ub4j_evloop_wait(struct ub4j_evloop* loop, int timeout_ms) {
+    int events = 0;
+#ifdef UB4J_USE_EPOLL
+    struct epoll_event ready[2];
+    int n = epoll_wait(loop->epoll_fd, ready, 2, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        events |= (int)ready[i].data.u32;
+    }
+#else
+    struct pollfd fds[2];
+    fds[0].fd = loop->watch_fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = loop->wake_read_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    int n = poll(fds, 2, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (fds[0].revents) {
+        events |= UB4J_EV_READABLE;
+    }
+    if (fds[1].revents) {
+        events |= UB4J_EV_WOKEN;
+    }
+#endif
+    if (events & UB4J_EV_WOKEN) {
+        drain_wake_fd(loop);
+    }
+    return events;
+}
+
+void ub4j_evloop_wake(struct ub4j_evloop* loop) {
+#ifdef UB4J_USE_EPOLL
+    uint64_t one = 1;
+    ssize_t ret = write(loop->wake_write_fd, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t ret = write(loop->wake_write_fd, &one, sizeof(one));
+#endif
+    // A full pipe or a saturated eventfd already guarantees a wakeup
+    (void)ret;
+}
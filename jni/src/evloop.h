@@ -0,0 +1,55 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_EVLOOP_H
+#define UNBOUND4J_EVLOOP_H
+
+/*
+ * Waits for a single file descriptor to become readable, for a timeout to elapse,
+ * or for another thread to wake us up.
+ *
+ * Uses epoll and an eventfd where available, and falls back to poll() and a pipe otherwise.
+ */
+
+#define UB4J_EV_READABLE 0x1
+#define UB4J_EV_WOKEN 0x2
+
+struct ub4j_evloop {
+    int epoll_fd; // -1 when using poll()
+    int watch_fd;
+    int wake_read_fd;
+    int wake_write_fd; // same as wake_read_fd when using an eventfd
+};
+
+int ub4j_evloop_init(struct ub4j_evloop* loop, int watch_fd);
+
+void ub4j_evloop_free(struct ub4j_evloop* loop);
+
+/**
+ * Blocks until the watched descriptor is readable, we're woken up, or timeout_ms elapses.
+ * A negative timeout waits indefinitely.
+ *
+ * @return a combination of UB4J_EV_READABLE and UB4J_EV_WOKEN, 0 on timeout, or -1 on error
+ */
+int ub4j_evloop_wait(struct ub4j_evloop* loop, int timeout_ms);
+
+/**
+ * Wakes up the thread blocked in ub4j_evloop_wait(), or makes its next call return immediately.
+ * Safe to call from any thread.
+ */
+void ub4j_evloop_wake(struct ub4j_evloop* loop);
+
+#endif //UNBOUND4J_EVLOOP_H
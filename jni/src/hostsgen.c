@@ -0,0 +1,361 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#include "overrides.h"
+
+/*
+ * Generates an overrides file, see overrides.h, from a list of addresses and hostnames.
+ *
+ * Usage: unbound4j_hostsgen [-i input] -o output
+ *
+ * The input, read from stdin by default, has an address and a hostname on every line, separated
+ * by whitespace or a comma, i.e. in the format of /etc/hosts. Anything after a # is ignored, as are
+ * any names after the first. When an address is listed more than once, the last hostname wins.
+ *
+ * The output is written to a temporary file that is renamed once complete, so that contexts
+ * can be pointed to the new file while it's being regenerated.
+ */
+
+struct v4_entry {
+    uint32_t addr;
+    uint32_t name;
+    size_t line;
+};
+
+struct v6_entry {
+    struct ub4j_addr_key key;
+    uint32_t name;
+    size_t line;
+};
+
+struct entries {
+    struct v4_entry* v4;
+    size_t v4_count;
+    size_t v4_capacity;
+    struct v6_entry* v6;
+    size_t v6_count;
+    size_t v6_capacity;
+    char* strings;
+    size_t strings_len;
+    size_t strings_capacity;
+};
+
+static int grow(void** items, size_t* capacity, size_t count, size_t item_len) {
+    if (count < *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? 1024 : *capacity * 2;
+    void* new_items = realloc(*items, new_capacity * item_len);
+    if (new_items == NULL) {
+        return -1;
+    }
+    *items = new_items;
+    *capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Appends the hostname to the string section, fully qualified like the names returned by Unbound.
+ */
+static int add_name(struct entries* entries, const char* name, uint32_t* offset) {
+    size_t len = strlen(name);
+    int needs_dot = len == 0 || name[len - 1] != '.';
+    size_t needed = len + (size_t)needs_dot + 1;
+    if (entries->strings_len + needed >= UINT32_MAX) {
+        fprintf(stderr, "Too many hostnames, the string section is limited to 4GB.\n");
+        return -1;
+    }
+    while (entries->strings_len + needed > entries->strings_capacity) {
+        size_t new_capacity = entries->strings_capacity == 0 ? 1 << 20 : entries->strings_capacity * 2;
+        char* strings = realloc(entries->strings, new_capacity);
+        if (strings == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            return -1;
+        }
+        entries->strings = strings;
+        entries->strings_capacity = new_capacity;
+    }
+
+    *offset = (uint32_t)entries->strings_len;
+    memcpy(entries->strings + entries->strings_len, name, len);
+    entries->strings_len += len;
+    if (needs_dot) {
+        entries->strings[entries->strings_len++] = '.';
+    }
+    entries->strings[entries->strings_len++] = '\0';
+    return 0;
+}
+
+static int read_entries(FILE* in, struct entries* entries) {
+    char* line = NULL;
+    size_t line_capacity = 0;
+    size_t line_number = 0;
+    while (getline(&line, &line_capacity, in) != -1) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char* saveptr = NULL;
+        char* addr = strtok_r(line, " \t,\r\n", &saveptr);
+        char* name = strtok_r(NULL, " \t,\r\n", &saveptr);
+        if (addr == NULL) {
+            continue;
+        } else if (name == NULL) {
+            fprintf(stderr, "Line %zu: missing hostname.\n", line_number);
+            free(line);
+            return -1;
+        }
+
+        uint8_t bytes[16];
+        uint32_t offset;
+        if (inet_pton(AF_INET, addr, bytes) == 1) {
+            if (grow((void**)&entries->v4, &entries->v4_capacity, entries->v4_count, sizeof(struct v4_entry)) ||
+                add_name(entries, name, &offset)) {
+                free(line);
+                return -1;
+            }
+            struct v4_entry* entry = &entries->v4[entries->v4_count++];
+            entry->addr = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+            entry->name = offset;
+            entry->line = line_number;
+        } else if (inet_pton(AF_INET6, addr, bytes) == 1) {
+            struct ub4j_addr_key key;
+            ub4j_addr_key_init(&key, bytes, sizeof(bytes));
+            if (ub4j_addr_key_is_v4(&key)) {
+                fprintf(stderr, "Line %zu: use the IPv4 form of IPv4-mapped addresses.\n", line_number);
+                free(line);
+                return -1;
+            }
+            if (grow((void**)&entries->v6, &entries->v6_capacity, entries->v6_count, sizeof(struct v6_entry)) ||
+                add_name(entries, name, &offset)) {
+                free(line);
+                return -1;
+            }
+            struct v6_entry* entry = &entries->v6[entries->v6_count++];
+            entry->key = key;
+            entry->name = offset;
+            entry->line = line_number;
+        } else {
+            fprintf(stderr, "Line %zu: invalid address: %s\n", line_number, addr);
+            free(line);
+            return -1;
+        }
+    }
+    free(line);
+    return 0;
+}
+
+static int compare_v4(const void* a, const void* b) {
+    const struct v4_entry* x = a;
+    const struct v4_entry* y = b;
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static int compare_v6(const void* a, const void* b) {
+    const struct v6_entry* x = a;
+    const struct v6_entry* y = b;
+    if (x->key.hi != y->key.hi) {
+        return x->key.hi < y->key.hi ? -1 : 1;
+    } else if (x->key.lo != y->key.lo) {
+        return x->key.lo < y->key.lo ? -1 : 1;
+    }
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/**
+ * Sorts the entries by address, keeping the last one given for each address.
+ */
+static void sort_entries(struct entries* entries) {
+    qsort(entries->v4, entries->v4_count, sizeof(struct v4_entry), compare_v4);
+    size_t count = 0;
+    for (size_t i = 0; i < entries->v4_count; i++) {
+        if (i + 1 < entries->v4_count && entries->v4[i + 1].addr == entries->v4[i].addr) {
+            continue;
+        }
+        entries->v4[count++] = entries->v4[i];
+    }
+    entries->v4_count = count;
+
+    qsort(entries->v6, entries->v6_count, sizeof(struct v6_entry), compare_v6);
+    count = 0;
+    for (size_t i = 0; i < entries->v6_count; i++) {
+        if (i + 1 < entries->v6_count && ub4j_addr_key_equals(&entries->v6[i + 1].key, &entries->v6[i].key)) {
+            continue;
+        }
+        entries->v6[count++] = entries->v6[i];
+    }
+    entries->v6_count = count;
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static int write_padding(FILE* out, uint64_t* offset) {
+    static const char zeros[8] = {0};
+    uint64_t aligned = align8(*offset);
+    if (fwrite(zeros, 1, (size_t)(aligned - *offset), out) != aligned - *offset) {
+        return -1;
+    }
+    *offset = aligned;
+    return 0;
+}
+
+static int write_overrides(FILE* out, const struct entries* entries) {
+    struct ub4j_overrides_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UB4J_OVERRIDES_MAGIC, sizeof(header.magic));
+    header.byte_order = UB4J_OVERRIDES_BYTE_ORDER;
+    header.version = UB4J_OVERRIDES_VERSION;
+    header.v4_count = entries->v4_count;
+    header.v6_count = entries->v6_count;
+    header.v4_keys_offset = align8(sizeof(header));
+    header.v4_names_offset = align8(header.v4_keys_offset + entries->v4_count * sizeof(uint32_t));
+    header.v6_keys_offset = align8(header.v4_names_offset + entries->v4_count * sizeof(uint32_t));
+    header.v6_names_offset = align8(header.v6_keys_offset + entries->v6_count * sizeof(struct ub4j_addr_key));
+    header.strings_offset = align8(header.v6_names_offset + entries->v6_count * sizeof(uint32_t));
+    // Keep a single NUL at the start so that the section is never empty
+    header.strings_len = entries->strings_len + 1;
+
+    uint64_t offset = sizeof(header);
+    if (fwrite(&header, sizeof(header), 1, out) != 1 || write_padding(out, &offset)) {
+        return -1;
+    }
+    for (size_t i = 0; i < entries->v4_count; i++) {
+        if (fwrite(&entries->v4[i].addr, sizeof(uint32_t), 1, out) != 1) {
+            return -1;
+        }
+    }
+    offset += entries->v4_count * sizeof(uint32_t);
+    if (write_padding(out, &offset)) {
+        return -1;
+    }
+    for (size_t i = 0; i < entries->v4_count; i++) {
+        uint32_t name = entries->v4[i].name + 1;
+        if (fwrite(&name, sizeof(uint32_t), 1, out) != 1) {
+            return -1;
+        }
+    }
+    offset += entries->v4_count * sizeof(uint32_t);
+    if (write_padding(out, &offset)) {
+        return -1;
+    }
+    for (size_t i = 0; i < entries->v6_count; i++) {
+        if (fwrite(&entries->v6[i].key, sizeof(struct ub4j_addr_key), 1, out) != 1) {
+            return -1;
+        }
+    }
+    offset += entries->v6_count * sizeof(struct ub4j_addr_key);
+    if (write_padding(out, &offset)) {
+        return -1;
+    }
+    for (size_t i = 0; i < entries->v6_count; i++) {
+        uint32_t name = entries->v6[i].name + 1;
+        if (fwrite(&name, sizeof(uint32_t), 1, out) != 1) {
+            return -1;
+        }
+    }
+    offset += entries->v6_count * sizeof(uint32_t);
+    if (write_padding(out, &offset) || fputc('\0', out) == EOF ||
+        fwrite(entries->strings, 1, entries->strings_len, out) != entries->strings_len) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char* input = NULL;
+    const char* output = NULL;
+
+#ifdef HAVE_GETOPT_H
+    int opt;
+    while ((opt = getopt(argc, argv, "i:o:")) != -1) {
+        switch (opt) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-i input] -o output\n", argv[0]);
+                return 1;
+        }
+    }
+#endif
+
+    if (output == NULL) {
+        fprintf(stderr, "Usage: %s [-i input] -o output\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = input != NULL ? fopen(input, "r") : stdin;
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", input, strerror(errno));
+        return 1;
+    }
+
+    struct entries entries;
+    memset(&entries, 0, sizeof(entries));
+    int nret = read_entries(in, &entries);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (nret == 0) {
+        sort_entries(&entries);
+
+        char tmp_path[4096];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output);
+        FILE* out = fopen(tmp_path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "Failed to open %s: %s\n", tmp_path, strerror(errno));
+            nret = -1;
+        } else if (write_overrides(out, &entries) | fclose(out)) {
+            fprintf(stderr, "Failed to write %s: %s\n", tmp_path, strerror(errno));
+            remove(tmp_path);
+            nret = -1;
+        } else if (rename(tmp_path, output) != 0) {
+            fprintf(stderr, "Failed to rename %s to %s: %s\n", tmp_path, output, strerror(errno));
+            remove(tmp_path);
+            nret = -1;
+        } else {
+            printf("Wrote %zu IPv4 and %zu IPv6 addresses to %s\n", entries.v4_count, entries.v6_count, output);
+        }
+    }
+
+    free(entries.v4);
+    free(entries.v6);
+    free(entries.strings);
+    return nret == 0 ? 0 : 1;
+}
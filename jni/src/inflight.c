@@ -0,0 +1,204 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "inflight.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// libunbound hands out async ids sequentially, so using the id itself as the hash
+// places consecutive queries in consecutive slots
+#define INFLIGHT_HOME(table, id) (((size_t)(unsigned int)(id)) & (table)->mask)
+
+#define PENDING_HOME(table, key) (((size_t)ub4j_addr_key_hash(key)) & (table)->mask)
+
+static size_t table_capacity(size_t max_count) {
+    size_t capacity = 16;
+    while (capacity < max_count * 2) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+int ub4j_inflight_init(struct ub4j_inflight_table* table, size_t max_count) {
+    size_t capacity = table_capacity(max_count);
+
+    memset(table, 0, sizeof(struct ub4j_inflight_table));
+    table->slots = calloc(capacity, sizeof(struct ub4j_inflight_slot));
+    if (table->slots == NULL) {
+        return -1;
+    }
+    table->mask = capacity - 1;
+    table->max_count = max_count;
+    return 0;
+}
+
+void ub4j_inflight_free(struct ub4j_inflight_table* table) {
+    free(table->slots);
+    memset(table, 0, sizeof(struct ub4j_inflight_table));
+}
+
+size_t ub4j_inflight_size(const struct ub4j_inflight_table* table) {
+    return table->slots != NULL ? (table->mask + 1) * sizeof(struct ub4j_inflight_slot) : 0;
+}
+
+int ub4j_inflight_put(struct ub4j_inflight_table* table, int id, void* data) {
+    if (table->count >= table->max_count) {
+        return -1;
+    }
+
+    size_t i = INFLIGHT_HOME(table, id);
+    while (table->slots[i].data != NULL) {
+        if (table->slots[i].id == id) {
+            // Replace the existing entry
+            table->slots[i].data = data;
+            return 0;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    table->slots[i].id = id;
+    table->slots[i].data = data;
+    table->count++;
+    return 0;
+}
+
+void* ub4j_inflight_get(struct ub4j_inflight_table* table, int id) {
+    size_t i = INFLIGHT_HOME(table, id);
+    while (table->slots[i].data != NULL) {
+        if (table->slots[i].id == id) {
+            return table->slots[i].data;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return NULL;
+}
+
+void* ub4j_inflight_remove(struct ub4j_inflight_table* table, int id) {
+    size_t i = INFLIGHT_HOME(table, id);
+    while (table->slots[i].data != NULL) {
+        if (table->slots[i].id == id) {
+            return ub4j_inflight_remove_at(table, i);
+        }
+        i = (i + 1) & table->mask;
+    }
+    return NULL;
+}
+
+void* ub4j_inflight_remove_at(struct ub4j_inflight_table* table, size_t index) {
+    void* data = table->slots[index].data;
+    if (data == NULL) {
+        return NULL;
+    }
+
+    // Backward-shift deletion: pull any later entries in the same probe run into the hole
+    // if they would still be reachable from their home slot
+    size_t hole = index;
+    size_t i = (hole + 1) & table->mask;
+    while (table->slots[i].data != NULL) {
+        size_t home = INFLIGHT_HOME(table, table->slots[i].id);
+        if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    table->slots[hole].id = 0;
+    table->slots[hole].data = NULL;
+    table->count--;
+    return data;
+}
+
+int ub4j_pending_init(struct ub4j_pending_table* table, size_t max_count) {
+    size_t capacity = table_capacity(max_count);
+
+    memset(table, 0, sizeof(struct ub4j_pending_table));
+    table->slots = calloc(capacity, sizeof(struct ub4j_pending_slot));
+    if (table->slots == NULL) {
+        return -1;
+    }
+    table->mask = capacity - 1;
+    return 0;
+}
+
+void ub4j_pending_free(struct ub4j_pending_table* table) {
+    free(table->slots);
+    memset(table, 0, sizeof(struct ub4j_pending_table));
+}
+
+size_t ub4j_pending_size(const struct ub4j_pending_table* table) {
+    return table->slots != NULL ? (table->mask + 1) * sizeof(struct ub4j_pending_slot) : 0;
+}
+
+void ub4j_pending_put(struct ub4j_pending_table* table, const struct ub4j_addr_key* key, void* data) {
+    // There is never more than one pending query per address, and the callers are limited
+    // by the in-flight table, so the table can't fill up
+    size_t i = PENDING_HOME(table, key);
+    while (table->slots[i].data != NULL) {
+        if (ub4j_addr_key_equals(&table->slots[i].key, key)) {
+            table->slots[i].data = data;
+            return;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    table->slots[i].key = *key;
+    table->slots[i].data = data;
+    table->count++;
+}
+
+void* ub4j_pending_get(struct ub4j_pending_table* table, const struct ub4j_addr_key* key) {
+    size_t i = PENDING_HOME(table, key);
+    while (table->slots[i].data != NULL) {
+        if (ub4j_addr_key_equals(&table->slots[i].key, key)) {
+            return table->slots[i].data;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return NULL;
+}
+
+void* ub4j_pending_remove(struct ub4j_pending_table* table, const struct ub4j_addr_key* key) {
+    size_t i = PENDING_HOME(table, key);
+    while (table->slots[i].data != NULL) {
+        if (ub4j_addr_key_equals(&table->slots[i].key, key)) {
+            break;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    void* data = table->slots[i].data;
+    if (data == NULL) {
+        return NULL;
+    }
+
+    // Same backward-shift deletion as for the in-flight table
+    size_t hole = i;
+    i = (hole + 1) & table->mask;
+    while (table->slots[i].data != NULL) {
+        size_t home = PENDING_HOME(table, &table->slots[i].key);
+        if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    memset(&table->slots[hole], 0, sizeof(struct ub4j_pending_slot));
+    table->count--;
+    return data;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_INFLIGHT_H
+#define UNBOUND4J_INFLIGHT_H
+
+#include <stddef.h>
+
+#include "addrkey.h"
+
+/*
+ * Fixed-size open-addressing table used to track the queries that are currently
+ * in flight on a context, keyed by the async id returned by ub_resolve_async().
+ *
+ * The slot array is allocated once, with at least twice as many slots as the maximum
+ * number of queries so that probe sequences stay short. Removals use backward-shift
+ * deletion, so there are no tombstones and the table never needs to be rebuilt.
+ *
+ * The table does no locking of its own.
+ */
+
+struct ub4j_inflight_slot {
+    int id;
+    void* data; // NULL when the slot is free
+};
+
+struct ub4j_inflight_table {
+    struct ub4j_inflight_slot* slots;
+    size_t mask;
+    size_t count;
+    size_t max_count;
+};
+
+int ub4j_inflight_init(struct ub4j_inflight_table* table, size_t max_count);
+
+void ub4j_inflight_free(struct ub4j_inflight_table* table);
+
+int ub4j_inflight_put(struct ub4j_inflight_table* table, int id, void* data);
+
+void* ub4j_inflight_get(struct ub4j_inflight_table* table, int id);
+
+void* ub4j_inflight_remove(struct ub4j_inflight_table* table, int id);
+
+void* ub4j_inflight_remove_at(struct ub4j_inflight_table* table, size_t index);
+
+size_t ub4j_inflight_size(const struct ub4j_inflight_table* table);
+
+/*
+ * Companion table keyed by address, used to find the query that is already in flight
+ * for an address. It's sized and managed the same way as the table above.
+ */
+
+struct ub4j_pending_slot {
+    struct ub4j_addr_key key;
+    void* data; // NULL when the slot is free
+};
+
+struct ub4j_pending_table {
+    struct ub4j_pending_slot* slots;
+    size_t mask;
+    size_t count;
+};
+
+int ub4j_pending_init(struct ub4j_pending_table* table, size_t max_count);
+
+void ub4j_pending_free(struct ub4j_pending_table* table);
+
+void ub4j_pending_put(struct ub4j_pending_table* table, const struct ub4j_addr_key* key, void* data);
+
+void* ub4j_pending_get(struct ub4j_pending_table* table, const struct ub4j_addr_key* key);
+
+void* ub4j_pending_remove(struct ub4j_pending_table* table, const struct ub4j_addr_key* key);
+
+size_t ub4j_pending_size(const struct ub4j_pending_table* table);
+
+#endif //UNBOUND4J_INFLIGHT_H
@@ -16,6 +16,7 @@
 
 #include "jniutils.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 // Sourced from https://stackoverflow.com/questions/230689/best-way-to-throw-exceptions-in-jni-code/12215825
@@ -72,62 +73,42 @@ jint throwOutOfMemoryError( JNIEnv *env, char *message )
     return (*env)->ThrowNew( env, exClass, message );
 }
 
-jint completeCompletableFutureExceptionally( JNIEnv *env, jobject future, const char *message )
-{
-    jclass cfClass;
-    jclass exClass;
-    char *cfClassName = "java/util/concurrent/CompletableFuture" ;
-    char *exClassName = "java/lang/RuntimeException" ;
-
-    cfClass = (*env)->FindClass( env, cfClassName );
-    if ( cfClass == NULL ) {
-        return throwNoClassDefError( env, cfClassName );
-    }
-
-    jmethodID completeExceptionally = (*env)->GetMethodID(env, cfClass, "completeExceptionally", "(Ljava/lang/Throwable;)Z");
-    if (completeExceptionally == NULL) {
-        return throwRuntimeException(env, "completeExceptionally method not found.");
-    }
-
-    int ret = 0;
-    jobject ex = NULL;
-
-    exClass = (*env)->FindClass( env, exClassName );
-    if ( exClass == NULL ) {
-        throwNoClassDefError( env, exClassName );
-        ret = -1;
-        goto complete;
-    }
-
-    jmethodID exConstructor = (*env)->GetMethodID(env, exClass, "<init>", "(Ljava/lang/String;)V");
-    if (exConstructor == NULL) {
-        throwRuntimeException(env, "Constructor on RuntimeException not found.");
-        ret = -1;
-        goto complete;
-    }
-
-    jstring messageString = (*env)->NewStringUTF(env, message);
-    if (messageString == NULL) {
-        throwRuntimeException(env, "Failed to create Java string for exception message");
-        ret = -1;
-        goto complete;
+/**
+ * Calls the getter with the given name, which must take no arguments and return an int, and stores the result in value.
+ * Returns 0 on success, or throws a RuntimeException and returns -1 if the method cannot be found.
+ */
+int call_int_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, int *value) {
+    jmethodID method = (*env)->GetMethodID(env, clazz, name, "()I");
+    if (method == NULL) {
+        char message[256];
+        snprintf(message, sizeof(message), "%s method not found.", name);
+        throwRuntimeException(env, message);
+        return -1;
     }
+    *value = (*env)->CallIntMethod(env, obj, method);
+    return 0;
+}
 
-    ex = (*env)->NewObject(env, exClass, exConstructor, messageString);
-    if (ex == NULL) {
-        throwRuntimeException(env, "Failed to create new RuntimeException");
-        ret = -1;
-        goto complete;
+int call_long_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, int64_t *value) {
+    jmethodID method = (*env)->GetMethodID(env, clazz, name, "()J");
+    if (method == NULL) {
+        char message[256];
+        snprintf(message, sizeof(message), "%s method not found.", name);
+        throwRuntimeException(env, message);
+        return -1;
     }
-
-    complete:
-    (*env)->CallBooleanMethod(env, future, completeExceptionally, ex);
-    return ret;
+    *value = (int64_t)(*env)->CallLongMethod(env, obj, method);
+    return 0;
 }
 
-int as_uint8_array(JNIEnv *env, jbyteArray array, uint8_t** buf) {
-    int len = (*env)->GetArrayLength(env, array);
-    *buf = malloc(sizeof(uint8_t) * len);
-    (*env)->GetByteArrayRegion(env, array, 0, len, (jbyte*)*buf);
-    return len;
+int call_boolean_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, short *value) {
+    jmethodID method = (*env)->GetMethodID(env, clazz, name, "()Z");
+    if (method == NULL) {
+        char message[256];
+        snprintf(message, sizeof(message), "%s method not found.", name);
+        throwRuntimeException(env, message);
+        return -1;
+    }
+    *value = (*env)->CallBooleanMethod(env, obj, method) ? 1 : 0;
+    return 0;
 }
@@ -24,8 +24,11 @@ jint throwNoClassDefError( JNIEnv *env, char *message );
 jint throwNoSuchFieldError( JNIEnv *env, char *message );
 jint throwRuntimeException( JNIEnv *env, char *message );
 jint throwOutOfMemoryError( JNIEnv *env, char *message );
-jint completeCompletableFutureExceptionally( JNIEnv *env, jobject future, const char *message );
 
-int as_uint8_array(JNIEnv *env, jbyteArray array, uint8_t** buf);
+int call_int_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, int *value);
+
+int call_long_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, int64_t *value);
+
+int call_boolean_getter(JNIEnv *env, jobject obj, jclass clazz, const char *name, short *value);
 
 #endif //UNBOUND4J_JNIUTILS_H
@@ -14,32 +14,59 @@
  * limitations under the License.
  */
 
+#include "config.h"
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <unbound.h>
 
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
 #include "unbound4j.h"
+#include "timeutils.h"
 
 /*
  * Used to generate a large number of reverse lookup requests to
  * test the system under load.
+ *
+ * Usage: unbound4j_main [-s shards[,shards...]] [-t threads] [-d seconds] [-c unbound.conf] [-C cache capacity] [-v]
+ *
+ * A run is made for every shard count given, so that the throughput can be compared i.e.:
+ *   unbound4j_main -s 1,2,4,8 -t 12 -d 10
  */
 
+#define MAX_THREADS 256
+
 volatile int done = 0;
+volatile int verbose = 0;
 atomic_int ip_generator = ATOMIC_VAR_INIT(16843009); // Start at 1.1.1.1
 
-void callback(void* mydata, const char* err_str, char* result) {
-    if (err_str != NULL) {
-        printf("Error: %s\n", err_str);
+atomic_long submitted = ATOMIC_VAR_INIT(0);
+atomic_long rejected = ATOMIC_VAR_INIT(0);
+atomic_long completed = ATOMIC_VAR_INIT(0);
+atomic_long failed = ATOMIC_VAR_INIT(0);
+
+void callback(void* mydata, enum ub4j_status status, const char* result) {
+    if (status != UB4J_STATUS_OK && status != UB4J_STATUS_STALE && status != UB4J_STATUS_NOT_ADMITTED) {
+        atomic_fetch_add(&failed, 1);
+        if (verbose) {
+            printf("Error: %s\n", ub4j_strerror(status));
+        }
     } else if (result != NULL) {
-        printf("Result: %s\n", result);
-        free(result);
-    } else {
+        if (verbose) {
+            printf("Result: %s\n", result);
+        }
+    } else if (verbose) {
         printf("(No result)\n");
     }
+    atomic_fetch_add(&completed, 1);
 }
 
 void *thread_routine_r( void *arg ) {
@@ -57,35 +84,41 @@ void *thread_routine_r( void *arg ) {
         // Perform lookups for each of these
         for (int i = 0; i < 3; i++) {
             if (ub4j_reverse_lookup(ctx->id, (uint8_t*)(&(ips[i])), 4, NULL, callback, error_str, error_len)) {
-                printf("lookup failed: %s", error_str);
+                // Most likely at the in-flight limit, back off a little
+                atomic_fetch_add(&rejected, 1);
+                if (verbose) {
+                    printf("lookup failed: %s\n", error_str);
+                }
+                sched_yield();
+            } else {
+                atomic_fetch_add(&submitted, 1);
             }
         }
     }
+    return NULL;
 }
 
-int main() {
-    ub4j_init();
-
-    printf("libunbound v%s\n", ub_version());
-
-    struct ub4j_config config;
-    ub4j_config_init(&config);
-
+int run(struct ub4j_config* config, int num_threads, int duration_secs) {
     char error[256];
     size_t  error_len = sizeof(error);
-    struct ub4j_context* ctx = ub4j_create_context(&config, error, error_len);
+    struct ub4j_context* ctx = ub4j_create_context(config, error, error_len);
 
     if (ctx == NULL) {
         printf("Failed to create context: %s\n", error);
-        ub4j_destroy();
         return 1;
     }
 
+    done = 0;
+    atomic_store(&submitted, 0);
+    atomic_store(&rejected, 0);
+    atomic_store(&completed, 0);
+    atomic_store(&failed, 0);
+
     // Spawn the lookup threads
-    const int NUM_THREADS = 12;
-    pthread_t dns_lookup_threads[NUM_THREADS];
+    pthread_t dns_lookup_threads[MAX_THREADS];
     int status;
-    for (int i = 0; i < NUM_THREADS; i++) {
+    uint64_t start_ms = ub4j_monotonic_ms();
+    for (int i = 0; i < num_threads; i++) {
         if (( status = pthread_create( &(dns_lookup_threads[i]), NULL, thread_routine_r, ctx) )) {
             printf("failure: status %d\n", status);
             return 1;
@@ -93,14 +126,99 @@ int main() {
     }
 
     // Wait
-    sleep(10);
+    sleep(duration_secs);
 
     // Stop
     done = 1;
-    for (int i = 0; i < NUM_THREADS; i++) {
-        void *thread_result;
-        status = pthread_join( dns_lookup_threads[i], &thread_result );
-        printf("thread result: %d %ld\n", status, (long)thread_result);
+    long completed_in_window = atomic_load(&completed);
+    uint64_t elapsed_ms = ub4j_monotonic_ms() - start_ms;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join( dns_lookup_threads[i], NULL );
+    }
+
+    // Give the outstanding lookups a chance to complete before tearing down the context
+    uint64_t drain_until_ms = ub4j_monotonic_ms() + (uint64_t)config->request_timeout_ms + 1000;
+    while (atomic_load(&completed) < atomic_load(&submitted) && ub4j_monotonic_ms() < drain_until_ms) {
+        usleep(10000);
+    }
+
+    struct ub4j_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (ub4j_get_stats(ctx->id, &stats, error, error_len)) {
+        printf("Failed to retrieve context stats: %s\n", error);
+    }
+
+    if (ub4j_delete_context(ctx->id, error, error_len)) {
+        printf("Failed to delete context: %s\n", error);
+    }
+
+    printf("shards=%d threads=%d submitted=%ld rejected=%ld completed=%ld failed=%ld rate=%.0f lookups/s\n",
+            config->shards, num_threads, atomic_load(&submitted), atomic_load(&rejected), atomic_load(&completed),
+            atomic_load(&failed), completed_in_window * 1000.0 / (double)elapsed_ms);
+    printf("  cache_hits=%llu coalesced=%llu queries_sent=%llu timeouts=%llu hostname_allocations=%llu\n",
+            (unsigned long long)stats.cache_hits, (unsigned long long)stats.coalesced,
+            (unsigned long long)stats.queries_sent, (unsigned long long)stats.timeouts,
+            (unsigned long long)stats.hostname_allocations);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char* shard_counts = "1";
+    int num_threads = 12;
+    int duration_secs = 10;
+
+    struct ub4j_config config;
+    ub4j_config_init(&config);
+
+#ifdef HAVE_GETOPT_H
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:d:c:C:v")) != -1) {
+        switch (opt) {
+            case 's':
+                shard_counts = optarg;
+                break;
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            case 'd':
+                duration_secs = atoi(optarg);
+                break;
+            case 'c':
+                config.use_system_resolver = 0;
+                config.unbound_config = optarg;
+                break;
+            case 'C':
+                config.cache_capacity = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s shards[,shards...]] [-t threads] [-d seconds] [-c unbound.conf] [-C cache capacity] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+#endif
+
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Number of threads must be between 1 and %d.\n", MAX_THREADS);
+        return 1;
+    }
+
+    ub4j_init();
+
+    printf("libunbound v%s\n", ub_version());
+
+    char shard_list[256];
+    snprintf(shard_list, sizeof(shard_list), "%s", shard_counts);
+    char* saveptr = NULL;
+    for (char* tok = strtok_r(shard_list, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+        config.shards = atoi(tok);
+        if (run(&config, num_threads, duration_secs)) {
+            ub4j_destroy();
+            return 1;
+        }
     }
 
     ub4j_destroy();
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_MPSC_H
+#define UNBOUND4J_MPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Lock-free multi-producer, single-consumer queue of intrusive nodes.
+ *
+ * Producers push onto a singly-linked stack with a single compare-and-swap. The consumer
+ * takes the whole stack at once with an atomic exchange and reverses it, so nodes come out
+ * in the order they were pushed. Since the consumer never pops individual nodes, the stack
+ * isn't exposed to the ABA problem.
+ */
+
+struct ub4j_mpsc_node {
+    struct ub4j_mpsc_node* next;
+};
+
+struct ub4j_mpsc_queue {
+    _Atomic(struct ub4j_mpsc_node*) head;
+};
+
+static inline void ub4j_mpsc_init(struct ub4j_mpsc_queue* queue) {
+    atomic_init(&queue->head, NULL);
+}
+
+/**
+ * Pushes a node onto the queue.
+ *
+ * @return 1 if the queue was empty, in which case the consumer may need to be woken up, 0 otherwise
+ */
+static inline int ub4j_mpsc_push(struct ub4j_mpsc_queue* queue, struct ub4j_mpsc_node* node) {
+    struct ub4j_mpsc_node* head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&queue->head, &head, node,
+                                                    memory_order_release, memory_order_relaxed));
+    return head == NULL;
+}
+
+/**
+ * Takes all of the nodes off the queue, and returns them in the order they were pushed.
+ * Only the consumer may call this.
+ */
+static inline struct ub4j_mpsc_node* ub4j_mpsc_take_all(struct ub4j_mpsc_queue* queue) {
+    struct ub4j_mpsc_node* node = atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+    struct ub4j_mpsc_node* reversed = NULL;
+    while (node != NULL) {
+        struct ub4j_mpsc_node* next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+    return reversed;
+}
+
+#endif //UNBOUND4J_MPSC_H
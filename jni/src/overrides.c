@@ -0,0 +1,162 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "overrides.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Checks that a section of count entries of the given size lies within the file, and is aligned.
+ */
+static int check_section(uint64_t offset, uint64_t count, size_t entry_len, size_t file_len) {
+    if (offset % 8 != 0 || offset > file_len || count > (file_len - offset) / entry_len) {
+        return -1;
+    }
+    return 0;
+}
+
+struct ub4j_overrides* ub4j_overrides_open(const char* path, char* error, size_t error_len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(error, error_len, "Failed to open overrides file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ub4j_overrides_header)) {
+        close(fd);
+        snprintf(error, error_len, "Invalid overrides file %s: too short.", path);
+        return NULL;
+    }
+
+    size_t map_len = (size_t)st.st_size;
+    void* map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid once the descriptor is closed
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(error, error_len, "Failed to map overrides file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    const struct ub4j_overrides_header* header = (const struct ub4j_overrides_header*)map;
+    const char* strings = (const char*)map + header->strings_offset;
+    if (memcmp(header->magic, UB4J_OVERRIDES_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != UB4J_OVERRIDES_BYTE_ORDER || header->version != UB4J_OVERRIDES_VERSION ||
+        check_section(header->v4_keys_offset, header->v4_count, sizeof(uint32_t), map_len) ||
+        check_section(header->v4_names_offset, header->v4_count, sizeof(uint32_t), map_len) ||
+        check_section(header->v6_keys_offset, header->v6_count, sizeof(struct ub4j_addr_key), map_len) ||
+        check_section(header->v6_names_offset, header->v6_count, sizeof(uint32_t), map_len) ||
+        header->strings_len == 0 || header->strings_len > UINT32_MAX ||
+        check_section(header->strings_offset, header->strings_len, 1, map_len) ||
+        strings[header->strings_len - 1] != '\0') {
+        munmap(map, map_len);
+        snprintf(error, error_len, "Invalid overrides file %s: bad header.", path);
+        return NULL;
+    }
+
+    // Make sure every name points within the string section, so that lookups don't need to
+    const uint32_t* v4_names = (const uint32_t*)((const char*)map + header->v4_names_offset);
+    const uint32_t* v6_names = (const uint32_t*)((const char*)map + header->v6_names_offset);
+    for (uint64_t i = 0; i < header->v4_count; i++) {
+        if (v4_names[i] >= header->strings_len) {
+            munmap(map, map_len);
+            snprintf(error, error_len, "Invalid overrides file %s: bad hostname offset.", path);
+            return NULL;
+        }
+    }
+    for (uint64_t i = 0; i < header->v6_count; i++) {
+        if (v6_names[i] >= header->strings_len) {
+            munmap(map, map_len);
+            snprintf(error, error_len, "Invalid overrides file %s: bad hostname offset.", path);
+            return NULL;
+        }
+    }
+
+    struct ub4j_overrides* overrides = malloc(sizeof(struct ub4j_overrides));
+    if (overrides == NULL) {
+        munmap(map, map_len);
+        snprintf(error, error_len, "Failed to allocate memory for overrides.");
+        return NULL;
+    }
+    overrides->map = map;
+    overrides->map_len = map_len;
+    overrides->v4_keys = (const uint32_t*)((const char*)map + header->v4_keys_offset);
+    overrides->v4_names = v4_names;
+    overrides->v4_count = (size_t)header->v4_count;
+    overrides->v6_keys = (const struct ub4j_addr_key*)((const char*)map + header->v6_keys_offset);
+    overrides->v6_names = v6_names;
+    overrides->v6_count = (size_t)header->v6_count;
+    overrides->strings = strings;
+    return overrides;
+}
+
+void ub4j_overrides_close(struct ub4j_overrides* overrides) {
+    if (overrides == NULL) {
+        return;
+    }
+    munmap(overrides->map, overrides->map_len);
+    free(overrides);
+}
+
+/*
+ * The searches below narrow the range down by halves, picking the half with a conditional move
+ * rather than a branch, so that the number of steps only depends on the size of the table and
+ * there are no mispredictions.
+ */
+
+static const char* find_v4(const struct ub4j_overrides* overrides, uint32_t addr) {
+    size_t n = overrides->v4_count;
+    if (n == 0) {
+        return NULL;
+    }
+    const uint32_t* base = overrides->v4_keys;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = base[half] <= addr ? base + half : base;
+        n -= half;
+    }
+    return *base == addr ? overrides->strings + overrides->v4_names[base - overrides->v4_keys] : NULL;
+}
+
+static const char* find_v6(const struct ub4j_overrides* overrides, const struct ub4j_addr_key* key) {
+    size_t n = overrides->v6_count;
+    if (n == 0) {
+        return NULL;
+    }
+    const struct ub4j_addr_key* base = overrides->v6_keys;
+    while (n > 1) {
+        size_t half = n / 2;
+        const struct ub4j_addr_key* mid = base + half;
+        int before = (mid->hi < key->hi) | ((mid->hi == key->hi) & (mid->lo <= key->lo));
+        base = before ? mid : base;
+        n -= half;
+    }
+    return ub4j_addr_key_equals(base, key) ? overrides->strings + overrides->v6_names[base - overrides->v6_keys] : NULL;
+}
+
+const char* ub4j_overrides_find(const struct ub4j_overrides* overrides, const struct ub4j_addr_key* key) {
+    if (ub4j_addr_key_is_v4(key)) {
+        return find_v4(overrides, (uint32_t)key->lo);
+    }
+    return find_v6(overrides, key);
+}
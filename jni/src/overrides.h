@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_OVERRIDES_H
+#define UNBOUND4J_OVERRIDES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addrkey.h"
+
+/*
+ * Static address to hostname overrides, i.e. exported from an IPAM system, stored in a
+ * memory-mapped file generated by unbound4j_hostsgen.
+ *
+ * The file is made up of the header, followed by the sections it points to:
+ *  - the IPv4 addresses, as sorted uint32_t
+ *  - the offsets of their hostnames in the string section, as uint32_t
+ *  - the IPv6 addresses, as sorted struct ub4j_addr_key
+ *  - the offsets of their hostnames
+ *  - the hostnames, NUL terminated
+ *
+ * Numbers are stored in the byte order of the host that generated the file, which must
+ * match that of the host that reads it. Sections are aligned to 8 bytes.
+ */
+
+#define UB4J_OVERRIDES_MAGIC "UB4JOVR1"
+#define UB4J_OVERRIDES_BYTE_ORDER 0x01020304U
+#define UB4J_OVERRIDES_VERSION 1
+
+struct ub4j_overrides_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t v4_count;
+    uint64_t v6_count;
+    uint64_t v4_keys_offset;
+    uint64_t v4_names_offset;
+    uint64_t v6_keys_offset;
+    uint64_t v6_names_offset;
+    uint64_t strings_offset;
+    uint64_t strings_len;
+};
+
+struct ub4j_overrides {
+    void* map;
+    size_t map_len;
+    const uint32_t* v4_keys;
+    const uint32_t* v4_names;
+    size_t v4_count;
+    const struct ub4j_addr_key* v6_keys;
+    const uint32_t* v6_names;
+    size_t v6_count;
+    const char* strings;
+};
+
+/**
+ * Maps the given file, and checks that it's well formed.
+ *
+ * @return the overrides, or NULL with the error filled in
+ */
+struct ub4j_overrides* ub4j_overrides_open(const char* path, char* error, size_t error_len);
+
+void ub4j_overrides_close(struct ub4j_overrides* overrides);
+
+/**
+ * @return the hostname for the address, or NULL if there is none. The hostname is only valid
+ *  until the overrides are closed.
+ */
+const char* ub4j_overrides_find(const struct ub4j_overrides* overrides, const struct ub4j_addr_key* key);
+
+#endif //UNBOUND4J_OVERRIDES_H
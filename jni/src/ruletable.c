@@ -0,0 +1,205 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ruletable.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Special-purpose ranges (RFC 6890) that have no meaningful reverse zone on the public internet.
+ */
+static const struct {
+    const char* addr;
+    int prefix_len;
+} SPECIAL_PURPOSE_V4[] = {
+    {"0.0.0.0", 8},          // "this" network
+    {"10.0.0.0", 8},         // private-use
+    {"100.64.0.0", 10},      // shared address space (CGNAT)
+    {"127.0.0.0", 8},        // loopback
+    {"169.254.0.0", 16},     // link local
+    {"172.16.0.0", 12},      // private-use
+    {"192.0.0.0", 24},       // IETF protocol assignments
+    {"192.0.2.0", 24},       // documentation (TEST-NET-1)
+    {"192.168.0.0", 16},     // private-use
+    {"198.18.0.0", 15},      // benchmarking
+    {"198.51.100.0", 24},    // documentation (TEST-NET-2)
+    {"203.0.113.0", 24},     // documentation (TEST-NET-3)
+    {"224.0.0.0", 4},        // multicast
+    {"240.0.0.0", 4},        // reserved
+    {"255.255.255.255", 32}, // limited broadcast
+}, SPECIAL_PURPOSE_V6[] = {
+    {"::", 128},             // unspecified
+    {"::1", 128},            // loopback
+    {"100::", 64},           // discard-only
+    {"2001:db8::", 32},      // documentation
+    {"fc00::", 7},           // unique local
+    {"fe80::", 10},          // link local
+    {"ff00::", 8},           // multicast
+};
+
+#define RULE_HOME(table, key, len) ((size_t)(ub4j_addr_key_hash(key) ^ (uint64_t)(len) * 0x9e3779b97f4a7c15ULL) & (table)->mask)
+
+static struct ub4j_rule_entry* find_slot(const struct ub4j_rule_table* table, const struct ub4j_addr_key* prefix, int prefix_len) {
+    size_t i = RULE_HOME(table, prefix, prefix_len);
+    while (table->slots[i].used) {
+        if (table->slots[i].prefix_len == prefix_len && ub4j_addr_key_equals(&table->slots[i].prefix, prefix)) {
+            break;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return &table->slots[i];
+}
+
+static void add_length(int* lengths, int* length_count, int prefix_len) {
+    // Keep the lengths sorted longest first
+    int i = 0;
+    while (i < *length_count && lengths[i] > prefix_len) {
+        i++;
+    }
+    if (i < *length_count && lengths[i] == prefix_len) {
+        return;
+    }
+    memmove(&lengths[i + 1], &lengths[i], (size_t)(*length_count - i) * sizeof(int));
+    lengths[i] = prefix_len;
+    (*length_count)++;
+}
+
+static int add_rule(struct ub4j_rule_table* table, const struct ub4j_prefix_rule* rule, char* error, size_t error_len) {
+    struct ub4j_addr_key key;
+    int max_len = rule->addr_len * 8;
+    if (ub4j_addr_key_init(&key, rule->addr, (size_t)rule->addr_len) || rule->prefix_len < 0 || rule->prefix_len > max_len) {
+        snprintf(error, error_len, "Invalid prefix length: /%d", rule->prefix_len);
+        return -1;
+    }
+    if (rule->action != UB4J_RULE_ANSWER_EMPTY && rule->action != UB4J_RULE_ROUTE && rule->action != UB4J_RULE_RESOLVE) {
+        snprintf(error, error_len, "Invalid action for prefix rule: %d", (int)rule->action);
+        return -1;
+    }
+    if (rule->action == UB4J_RULE_ROUTE && rule->ctx_id <= 0) {
+        snprintf(error, error_len, "Invalid context id for prefix rule: %d", rule->ctx_id);
+        return -1;
+    }
+
+    // IPv4 prefixes live under the IPv4-mapped prefix, as do IPv6 prefixes within it
+    int prefix_len = 128 - max_len + rule->prefix_len;
+    struct ub4j_addr_key prefix;
+    ub4j_addr_key_mask(&key, prefix_len, &prefix);
+    if (prefix_len >= 96 && ub4j_addr_key_is_v4(&prefix)) {
+        add_length(table->v4_lengths, &table->v4_length_count, prefix_len);
+    } else {
+        add_length(table->v6_lengths, &table->v6_length_count, prefix_len);
+    }
+
+    // Later rules replace earlier ones for the same prefix
+    struct ub4j_rule_entry* entry = find_slot(table, &prefix, prefix_len);
+    if (!entry->used) {
+        entry->used = 1;
+        entry->prefix = prefix;
+        entry->prefix_len = prefix_len;
+        table->count++;
+    }
+    entry->action = rule->action;
+    entry->ctx_id = rule->action == UB4J_RULE_ROUTE ? rule->ctx_id : 0;
+    return 0;
+}
+
+static int add_special_purpose_rules(struct ub4j_rule_table* table, char* error, size_t error_len) {
+    struct ub4j_prefix_rule rule;
+    memset(&rule, 0, sizeof(rule));
+    rule.action = UB4J_RULE_ANSWER_EMPTY;
+
+    rule.addr_len = 4;
+    for (size_t i = 0; i < sizeof(SPECIAL_PURPOSE_V4) / sizeof(SPECIAL_PURPOSE_V4[0]); i++) {
+        inet_pton(AF_INET, SPECIAL_PURPOSE_V4[i].addr, rule.addr);
+        rule.prefix_len = SPECIAL_PURPOSE_V4[i].prefix_len;
+        if (add_rule(table, &rule, error, error_len)) {
+            return -1;
+        }
+    }
+
+    rule.addr_len = 16;
+    for (size_t i = 0; i < sizeof(SPECIAL_PURPOSE_V6) / sizeof(SPECIAL_PURPOSE_V6[0]); i++) {
+        inet_pton(AF_INET6, SPECIAL_PURPOSE_V6[i].addr, rule.addr);
+        rule.prefix_len = SPECIAL_PURPOSE_V6[i].prefix_len;
+        if (add_rule(table, &rule, error, error_len)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ub4j_rule_table_init(struct ub4j_rule_table* table, const struct ub4j_prefix_rule* rules, size_t rule_count,
+                         short special_purpose, char* error, size_t error_len) {
+    size_t max_count = rule_count;
+    if (special_purpose) {
+        max_count += sizeof(SPECIAL_PURPOSE_V4) / sizeof(SPECIAL_PURPOSE_V4[0]) +
+                     sizeof(SPECIAL_PURPOSE_V6) / sizeof(SPECIAL_PURPOSE_V6[0]);
+    }
+    size_t capacity = 16;
+    while (capacity < max_count * 2) {
+        capacity <<= 1;
+    }
+
+    memset(table, 0, sizeof(struct ub4j_rule_table));
+    table->slots = calloc(capacity, sizeof(struct ub4j_rule_entry));
+    if (table->slots == NULL) {
+        snprintf(error, error_len, "Failed to allocate memory for prefix rules.");
+        return -1;
+    }
+    table->mask = capacity - 1;
+
+    if (special_purpose && add_special_purpose_rules(table, error, error_len)) {
+        ub4j_rule_table_free(table);
+        return -1;
+    }
+    for (size_t i = 0; i < rule_count; i++) {
+        if (add_rule(table, &rules[i], error, error_len)) {
+            ub4j_rule_table_free(table);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ub4j_rule_table_free(struct ub4j_rule_table* table) {
+    free(table->slots);
+    memset(table, 0, sizeof(struct ub4j_rule_table));
+}
+
+const struct ub4j_rule_entry* ub4j_rule_table_find(const struct ub4j_rule_table* table, const struct ub4j_addr_key* key) {
+    const int* lengths;
+    int length_count;
+    if (ub4j_addr_key_is_v4(key)) {
+        lengths = table->v4_lengths;
+        length_count = table->v4_length_count;
+    } else {
+        lengths = table->v6_lengths;
+        length_count = table->v6_length_count;
+    }
+
+    for (int i = 0; i < length_count; i++) {
+        struct ub4j_addr_key prefix;
+        ub4j_addr_key_mask(key, lengths[i], &prefix);
+        const struct ub4j_rule_entry* entry = find_slot(table, &prefix, lengths[i]);
+        if (entry->used) {
+            return entry;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_RULETABLE_H
+#define UNBOUND4J_RULETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addrkey.h"
+
+enum ub4j_rule_action {
+    UB4J_RULE_ANSWER_EMPTY = 0, // answer without looking up the address
+    UB4J_RULE_ROUTE,            // look up the address with another context
+    UB4J_RULE_RESOLVE           // look up the address as usual, i.e. to exempt part of a wider prefix
+};
+
+/*
+ * A rule for the addresses in a prefix.
+ */
+struct ub4j_prefix_rule {
+    uint8_t addr[16];
+    int addr_len;   // 4 or 16
+    int prefix_len; // in bits of the address, i.e. at most 32 for IPv4
+    enum ub4j_rule_action action;
+    int ctx_id;     // context the lookups are routed to, for UB4J_RULE_ROUTE
+};
+
+/*
+ * Longest-prefix-match table over the rules of a context.
+ *
+ * The rules are stored in a single open-addressing table keyed by the masked prefix and its length.
+ * A lookup masks the address to each of the distinct prefix lengths in use, longest first, and
+ * stops at the first match. IPv4 and IPv6 rules keep separate lists of lengths so that IPv4
+ * addresses are only ever matched against IPv4 rules, and vice versa.
+ *
+ * The table is built once when the context is created, and is only read afterwards.
+ */
+
+struct ub4j_rule_entry {
+    struct ub4j_addr_key prefix;
+    int prefix_len; // out of 128, see ub4j_addr_key_mask()
+    enum ub4j_rule_action action;
+    int ctx_id;
+    short used;
+};
+
+struct ub4j_rule_table {
+    struct ub4j_rule_entry* slots;
+    size_t mask;
+    size_t count;
+    int v4_lengths[33]; // distinct prefix lengths in use, longest first
+    int v4_length_count;
+    int v6_lengths[129];
+    int v6_length_count;
+};
+
+/**
+ * Builds the table from the given rules, along with the special-purpose ranges of RFC 6890 answered empty
+ * when special_purpose is set. The given rules take precedence over the special-purpose ones for the same prefix.
+ *
+ * @return 0 on success, -1 otherwise with the error filled in
+ */
+int ub4j_rule_table_init(struct ub4j_rule_table* table, const struct ub4j_prefix_rule* rules, size_t rule_count,
+                         short special_purpose, char* error, size_t error_len);
+
+void ub4j_rule_table_free(struct ub4j_rule_table* table);
+
+/**
+ * @return the rule for the longest prefix that contains the address, or NULL if there is none
+ */
+const struct ub4j_rule_entry* ub4j_rule_table_find(const struct ub4j_rule_table* table, const struct ub4j_addr_key* key);
+
+#endif //UNBOUND4J_RULETABLE_H
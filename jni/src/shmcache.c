@@ -0,0 +1,244 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shmcache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long to wait for the process that creates the segment to finish setting it up
+#define ATTACH_WAIT_MS 1000
+// Processes of other users in the group of the creator can attach to the segment too
+#define SEGMENT_MODE 0660
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void* create_segment(int fd, size_t capacity, size_t* map_len) {
+    uint64_t sets = 1;
+    while (sets * UB4J_SHM_CACHE_WAYS < capacity) {
+        sets <<= 1;
+    }
+    size_t len = sizeof(struct ub4j_shm_cache_header) + sets * UB4J_SHM_CACHE_WAYS * sizeof(struct ub4j_shm_cache_slot);
+    // Don't let the umask take the permissions of the group away
+    if (fchmod(fd, SEGMENT_MODE) != 0 || ftruncate(fd, (off_t)len) != 0) {
+        return MAP_FAILED;
+    }
+    void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    // The segment starts out zeroed, so every slot is free
+    struct ub4j_shm_cache_header* header = (struct ub4j_shm_cache_header*)map;
+    memcpy(header->magic, UB4J_SHM_CACHE_MAGIC, sizeof(header->magic));
+    header->byte_order = UB4J_SHM_CACHE_BYTE_ORDER;
+    header->version = UB4J_SHM_CACHE_VERSION;
+    header->set_count = sets;
+    header->segment_len = len;
+    atomic_store_explicit(&header->ready, 1, memory_order_release);
+    *map_len = len;
+    return map;
+}
+
+static void* open_segment(int fd, size_t* map_len) {
+    // The segment may still be being set up by the process that created it
+    struct stat st;
+    for (int waited_ms = 0; ; waited_ms++) {
+        if (fstat(fd, &st) != 0) {
+            return MAP_FAILED;
+        }
+        if ((size_t)st.st_size >= sizeof(struct ub4j_shm_cache_header) || waited_ms >= ATTACH_WAIT_MS) {
+            break;
+        }
+        sleep_ms(1);
+    }
+    if ((size_t)st.st_size < sizeof(struct ub4j_shm_cache_header)) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    struct ub4j_shm_cache_header* header = (struct ub4j_shm_cache_header*)map;
+    for (int waited_ms = 0; !atomic_load_explicit(&header->ready, memory_order_acquire) && waited_ms < ATTACH_WAIT_MS; waited_ms++) {
+        sleep_ms(1);
+    }
+    if (!atomic_load_explicit(&header->ready, memory_order_acquire) ||
+        memcmp(header->magic, UB4J_SHM_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != UB4J_SHM_CACHE_BYTE_ORDER || header->version != UB4J_SHM_CACHE_VERSION ||
+        header->segment_len != len || header->set_count == 0 || (header->set_count & (header->set_count - 1)) != 0 ||
+        header->set_count > (len - sizeof(struct ub4j_shm_cache_header)) / UB4J_SHM_CACHE_WAYS / sizeof(struct ub4j_shm_cache_slot)) {
+        munmap(map, len);
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    *map_len = len;
+    return map;
+}
+
+struct ub4j_shm_cache* ub4j_shm_cache_attach(const char* name, size_t capacity, uint32_t max_ttl_secs, char* error, size_t error_len) {
+    struct ub4j_shm_cache* cache = malloc(sizeof(struct ub4j_shm_cache));
+    if (cache == NULL) {
+        snprintf(error, error_len, "Failed to allocate memory for shared cache.");
+        return NULL;
+    }
+
+    // Whoever manages to create the segment sets it up, everyone else waits for them to do so
+    void* map;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, SEGMENT_MODE);
+    if (fd >= 0) {
+        map = create_segment(fd, capacity, &cache->map_len);
+        if (map == MAP_FAILED) {
+            int saved_errno = errno;
+            shm_unlink(name);
+            errno = saved_errno;
+        }
+    } else if (errno == EEXIST && (fd = shm_open(name, O_RDWR, 0)) >= 0) {
+        map = open_segment(fd, &cache->map_len);
+    } else {
+        snprintf(error, error_len, "Failed to open shared cache %s: %s", name, strerror(errno));
+        free(cache);
+        return NULL;
+    }
+    // The mapping stays valid once the descriptor is closed
+    int saved_errno = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(error, error_len, "Failed to map shared cache %s: %s", name, strerror(saved_errno));
+        free(cache);
+        return NULL;
+    }
+
+    struct ub4j_shm_cache_header* header = (struct ub4j_shm_cache_header*)map;
+    cache->map = map;
+    cache->slots = (struct ub4j_shm_cache_slot*)((char*)map + sizeof(struct ub4j_shm_cache_header));
+    cache->set_mask = (size_t)header->set_count - 1;
+    cache->max_ttl_secs = max_ttl_secs;
+    return cache;
+}
+
+void ub4j_shm_cache_detach(struct ub4j_shm_cache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    munmap(cache->map, cache->map_len);
+    free(cache);
+}
+
+static inline struct ub4j_shm_cache_slot* set_slots(struct ub4j_shm_cache* cache, const struct ub4j_addr_key* key) {
+    return &cache->slots[((size_t)ub4j_addr_key_hash(key) & cache->set_mask) * UB4J_SHM_CACHE_WAYS];
+}
+
+enum ub4j_cache_outcome ub4j_shm_cache_get(struct ub4j_shm_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms, char* hostname, size_t hostname_len) {
+    struct ub4j_shm_cache_slot* slots = set_slots(cache, key);
+    for (int i = 0; i < UB4J_SHM_CACHE_WAYS; i++) {
+        struct ub4j_shm_cache_slot* slot = &slots[i];
+        unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+
+        // Anything we read here may be torn, it's only trusted once the sequence is known not to have moved
+        struct ub4j_addr_key slot_key;
+        memcpy(&slot_key, &slot->key, sizeof(slot_key));
+        uint64_t expires_ms = slot->expires_ms;
+        if (!ub4j_addr_key_equals(&slot_key, key) || expires_ms <= now_ms) {
+            continue;
+        }
+        enum ub4j_cache_outcome outcome = (enum ub4j_cache_outcome)slot->outcome;
+        if (outcome == UB4J_CACHE_HOSTNAME) {
+            size_t len = slot->hostname_len;
+            if (len >= UB4J_SHM_CACHE_HOSTNAME_LEN || len >= hostname_len) {
+                return UB4J_CACHE_MISS;
+            }
+            memcpy(hostname, slot->hostname, len);
+            hostname[len] = '\0';
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+            // Being replaced, treat it as gone
+            return UB4J_CACHE_MISS;
+        }
+        return outcome;
+    }
+    return UB4J_CACHE_MISS;
+}
+
+void ub4j_shm_cache_put(struct ub4j_shm_cache* cache, const struct ub4j_addr_key* key, enum ub4j_cache_outcome outcome,
+                        const char* hostname, uint32_t ttl_secs, uint64_t now_ms) {
+    if (ttl_secs > cache->max_ttl_secs) {
+        ttl_secs = cache->max_ttl_secs;
+    }
+    size_t len = outcome == UB4J_CACHE_HOSTNAME ? strlen(hostname) : 0;
+    if (ttl_secs == 0 || len >= UB4J_SHM_CACHE_HOSTNAME_LEN) {
+        return;
+    }
+
+    // Replace the entry for the same address, so that the set never holds two of them, otherwise a free
+    // or expired one, or the one closest to expiring. The keys and expiry times may be torn at this point,
+    // but they're only used to pick a victim.
+    struct ub4j_shm_cache_slot* slots = set_slots(cache, key);
+    struct ub4j_shm_cache_slot* victim = NULL;
+    for (int i = 0; i < UB4J_SHM_CACHE_WAYS && victim == NULL; i++) {
+        if (ub4j_addr_key_equals(&slots[i].key, key)) {
+            victim = &slots[i];
+        }
+    }
+    if (victim == NULL) {
+        victim = &slots[0];
+        for (int i = 0; i < UB4J_SHM_CACHE_WAYS; i++) {
+            struct ub4j_shm_cache_slot* slot = &slots[i];
+            if (slot->expires_ms <= now_ms) {
+                victim = slot;
+                break;
+            }
+            if (slot->expires_ms < victim->expires_ms) {
+                victim = slot;
+            }
+        }
+    }
+
+    unsigned int seq = atomic_load_explicit(&victim->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&victim->seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+        // Someone else is writing to the slot, their entry is as good as ours
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    victim->key = *key;
+    victim->expires_ms = now_ms + (uint64_t)ttl_secs * 1000;
+    victim->outcome = (uint8_t)outcome;
+    victim->hostname_len = (uint8_t)len;
+    if (len > 0) {
+        memcpy(victim->hostname, hostname, len);
+    }
+
+    atomic_store_explicit(&victim->seq, seq + 2, memory_order_release);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UNBOUND4J_SHMCACHE_H
+#define UNBOUND4J_SHMCACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addrkey.h"
+#include "cache.h"
+
+/*
+ * A result cache that lives in a named shared memory segment, so that every process on the host
+ * that attaches to the same name shares the answers, i.e. several JVMs enriching the same flows.
+ *
+ * The table is set-associative like struct ub4j_cache, but has a fixed layout with the hostnames
+ * stored inline, and no pointers. Every slot is guarded by a sequence lock: writers take it by
+ * moving the sequence from even to odd, and skip the write if another writer holds it, while
+ * readers copy the slot and retry, or miss, if the sequence changed in the meantime. Neither
+ * side ever blocks, so a process that dies while holding a slot only loses that slot.
+ *
+ * Expiry times are on CLOCK_MONOTONIC, which is shared by all of the processes on the host.
+ * The segment outlives the processes, it's only removed with shm_unlink() or a reboot.
+ */
+
+#define UB4J_SHM_CACHE_MAGIC "UB4JSHM1"
+#define UB4J_SHM_CACHE_BYTE_ORDER 0x01020304U
+#define UB4J_SHM_CACHE_VERSION 1
+#define UB4J_SHM_CACHE_WAYS 4
+// Keeps every slot to two cache lines. Longer hostnames are only kept by the local cache.
+#define UB4J_SHM_CACHE_HOSTNAME_LEN 96
+
+struct ub4j_shm_cache_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t set_count;
+    uint64_t segment_len;
+    atomic_uint ready; // set by the process that created the segment once the header is filled in
+    char pad[28];
+};
+
+struct ub4j_shm_cache_slot {
+    atomic_uint seq; // odd while the slot is being written
+    uint8_t outcome;
+    uint8_t hostname_len;
+    uint16_t pad;
+    struct ub4j_addr_key key;
+    uint64_t expires_ms; // 0 when the slot is free
+    char hostname[UB4J_SHM_CACHE_HOSTNAME_LEN];
+};
+
+struct ub4j_shm_cache {
+    void* map;
+    size_t map_len;
+    struct ub4j_shm_cache_slot* slots;
+    size_t set_mask;
+    uint32_t max_ttl_secs;
+};
+
+/**
+ * Attaches to the segment with the given name, i.e. "/unbound4j", creating it with room for at least
+ * capacity entries if it doesn't exist yet. The capacity of an existing segment is kept as is.
+ * Segments are created with mode 0660, so processes running as other users can only attach to it
+ * if they share the group of the process that created it.
+ *
+ * @return the cache, or NULL with the error filled in
+ */
+struct ub4j_shm_cache* ub4j_shm_cache_attach(const char* name, size_t capacity, uint32_t max_ttl_secs, char* error, size_t error_len);
+
+/**
+ * Unmaps the segment, leaving it in place for the other processes.
+ */
+void ub4j_shm_cache_detach(struct ub4j_shm_cache* cache);
+
+/**
+ * Same as ub4j_cache_get(). Entries whose hostname doesn't fit in the given buffer are treated as misses.
+ */
+enum ub4j_cache_outcome ub4j_shm_cache_get(struct ub4j_shm_cache* cache, const struct ub4j_addr_key* key, uint64_t now_ms, char* hostname, size_t hostname_len);
+
+/**
+ * Same as ub4j_cache_put(), except that the entry is dropped when the hostname is too long to be stored
+ * inline, or when another process is writing to the slot it would replace.
+ */
+void ub4j_shm_cache_put(struct ub4j_shm_cache* cache, const struct ub4j_addr_key* key, enum ub4j_cache_outcome outcome,
+                        const char* hostname, uint32_t ttl_secs, uint64_t now_ms);
+
+#endif //UNBOUND4J_SHMCACHE_H
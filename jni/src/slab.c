@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TOP_INDEX(top) ((uint32_t)(top))
+#define TOP_TAG(top) ((uint32_t)((top) >> 32))
+#define MAKE_TOP(tag, index) (((uint64_t)(tag) << 32) | (uint64_t)(index))
+
+int ub4j_slab_init(struct ub4j_slab* slab, size_t record_size, uint32_t count) {
+    memset(slab, 0, sizeof(struct ub4j_slab));
+
+    // Keep the records aligned for any type
+    record_size = (record_size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    slab->records = calloc(count, record_size);
+    slab->next_free = calloc(count, sizeof(_Atomic uint32_t));
+    if (slab->records == NULL || slab->next_free == NULL) {
+        free(slab->records);
+        free((void*)slab->next_free);
+        memset(slab, 0, sizeof(struct ub4j_slab));
+        return -1;
+    }
+    slab->record_size = record_size;
+    slab->count = count;
+
+    // Chain all of the records together, in order
+    for (uint32_t i = 0; i < count; i++) {
+        atomic_init(&slab->next_free[i], i + 1 < count ? i + 2 : 0);
+    }
+    atomic_init(&slab->top, MAKE_TOP(0, count > 0 ? 1 : 0));
+    return 0;
+}
+
+void ub4j_slab_free(struct ub4j_slab* slab) {
+    free(slab->records);
+    free((void*)slab->next_free);
+    memset(slab, 0, sizeof(struct ub4j_slab));
+}
+
+void* ub4j_slab_alloc(struct ub4j_slab* slab) {
+    uint64_t top = atomic_load_explicit(&slab->top, memory_order_acquire);
+    uint64_t new_top;
+    do {
+        uint32_t index = TOP_INDEX(top);
+        if (index == 0) {
+            return NULL;
+        }
+        // The record may be taken by someone else in the meantime, in which case the tag will have changed
+        uint32_t next = atomic_load_explicit(&slab->next_free[index - 1], memory_order_relaxed);
+        new_top = MAKE_TOP(TOP_TAG(top) + 1, next);
+    } while (!atomic_compare_exchange_weak_explicit(&slab->top, &top, new_top,
+                                                    memory_order_acquire, memory_order_acquire));
+    return slab->records + (size_t)(TOP_INDEX(top) - 1) * slab->record_size;
+}
+
+void ub4j_slab_release(struct ub4j_slab* slab, void* record) {
+    uint32_t index = (uint32_t)(((char*)record - slab->records) / slab->record_size) + 1;
+    uint64_t top = atomic_load_explicit(&slab->top, memory_order_relaxed);
+    uint64_t new_top;
+    do {
+        atomic_store_explicit(&slab->next_free[index - 1], TOP_INDEX(top), memory_order_relaxed);
+        new_top = MAKE_TOP(TOP_TAG(top) + 1, index);
+    } while (!atomic_compare_exchange_weak_explicit(&slab->top, &top, new_top,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+size_t ub4j_slab_size(const struct ub4j_slab* slab) {
+    return (size_t)slab->count * (slab->record_size + sizeof(_Atomic uint32_t));
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_SLAB_H
+#define UNBOUND4J_SLAB_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pool of fixed-size records, allocated all at once up front.
+ *
+ * Free records are kept on a lock-free stack, so records can be taken and returned from
+ * any thread. The top of the stack is tagged with a counter that is bumped on every
+ * change, which protects the compare-and-swap against the ABA problem.
+ */
+
+struct ub4j_slab {
+    char* records;
+    size_t record_size;
+    uint32_t count;
+    _Atomic uint32_t* next_free; // index + 1 of the next free record, 0 for none
+    _Atomic uint64_t top;        // tag in the upper 32 bits, index + 1 of the first free record in the lower ones
+};
+
+int ub4j_slab_init(struct ub4j_slab* slab, size_t record_size, uint32_t count);
+
+void ub4j_slab_free(struct ub4j_slab* slab);
+
+/**
+ * Takes a record from the slab.
+ *
+ * @return the record, or NULL if all of the records are in use
+ */
+void* ub4j_slab_alloc(struct ub4j_slab* slab);
+
+/**
+ * Returns a record that was taken from the slab.
+ */
+void ub4j_slab_release(struct ub4j_slab* slab, void* record);
+
+/**
+ * @return the number of bytes allocated for the records
+ */
+size_t ub4j_slab_size(const struct ub4j_slab* slab);
+
+#endif //UNBOUND4J_SLAB_H
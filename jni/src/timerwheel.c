@@ -0,0 +1,186 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timerwheel.h"
+
+#include <string.h>
+
+#define TW_MASK ((uint64_t)(UB4J_TW_SLOTS - 1))
+#define TW_SPAN(level) ((uint64_t)1 << (UB4J_TW_BITS * ((level) + 1)))
+#define TW_INDEX(ms, level) ((unsigned char)(((ms) >> (UB4J_TW_BITS * (level))) & TW_MASK))
+
+static inline uint64_t rotate_right(uint64_t bits, unsigned int n) {
+    return n == 0 ? bits : (bits >> n) | (bits << (64 - n));
+}
+
+static void place_timer(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer) {
+    uint64_t expires_ms = timer->expires_ms;
+    if (expires_ms < wheel->current_ms) {
+        // Already due, fire on the next tick
+        expires_ms = wheel->current_ms;
+    }
+
+    uint64_t delta = expires_ms - wheel->current_ms;
+    unsigned char level = 0;
+    while (level < UB4J_TW_LEVELS && delta >= TW_SPAN(level)) {
+        level++;
+    }
+    if (level == UB4J_TW_LEVELS) {
+        // Beyond the span of the wheel, park it in the furthest slot and file it again once we get there
+        level = UB4J_TW_LEVELS - 1;
+        expires_ms = wheel->current_ms + TW_SPAN(level) - 1;
+    }
+
+    unsigned char slot = TW_INDEX(expires_ms, level);
+    struct ub4j_timer** head = &wheel->slots[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void unlink_timer(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (wheel->slots[timer->level][timer->slot] == NULL) {
+        wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void cascade(struct ub4j_timer_wheel* wheel, unsigned char level, unsigned char slot) {
+    struct ub4j_timer* timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+    while (timer != NULL) {
+        struct ub4j_timer* next = timer->next;
+        place_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+void ub4j_timer_wheel_init(struct ub4j_timer_wheel* wheel, uint64_t now_ms) {
+    memset(wheel, 0, sizeof(struct ub4j_timer_wheel));
+    wheel->current_ms = now_ms;
+}
+
+void ub4j_timer_add(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer, uint64_t expires_ms) {
+    if (timer->pprev != NULL) {
+        unlink_timer(wheel, timer);
+        wheel->count--;
+    }
+    timer->expires_ms = expires_ms;
+    place_timer(wheel, timer);
+    wheel->count++;
+}
+
+void ub4j_timer_remove(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer) {
+    if (timer->pprev == NULL) {
+        // Not scheduled
+        return;
+    }
+    unlink_timer(wheel, timer);
+    wheel->count--;
+}
+
+struct ub4j_timer* ub4j_timer_wheel_advance(struct ub4j_timer_wheel* wheel, uint64_t now_ms) {
+    struct ub4j_timer* expired = NULL;
+    struct ub4j_timer** tail = &expired;
+
+    while (wheel->count > 0 && wheel->current_ms <= now_ms) {
+        unsigned char index = TW_INDEX(wheel->current_ms, 0);
+        if (index == 0) {
+            // Level 0 wrapped around, pull down the timers from the levels above
+            for (unsigned char level = 1; level < UB4J_TW_LEVELS; level++) {
+                unsigned char slot = TW_INDEX(wheel->current_ms, level);
+                cascade(wheel, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+
+        struct ub4j_timer* timer = wheel->slots[0][index];
+        if (timer != NULL) {
+            wheel->slots[0][index] = NULL;
+            wheel->occupied[0] &= ~((uint64_t)1 << index);
+            while (timer != NULL) {
+                struct ub4j_timer* next = timer->next;
+                timer->next = NULL;
+                timer->pprev = NULL;
+                *tail = timer;
+                tail = &timer->next;
+                wheel->count--;
+                timer = next;
+            }
+        }
+        wheel->current_ms++;
+
+        if (wheel->occupied[0] == 0) {
+            // Nothing left on level 0, skip ahead to the next time it wraps around
+            uint64_t boundary = (wheel->current_ms + TW_MASK) & ~TW_MASK;
+            wheel->current_ms = boundary <= now_ms ? boundary : now_ms + 1;
+        }
+    }
+
+    if (wheel->count == 0 && wheel->current_ms <= now_ms) {
+        wheel->current_ms = now_ms + 1;
+    }
+    return expired;
+}
+
+int ub4j_timer_wheel_next_deadline(struct ub4j_timer_wheel* wheel, uint64_t* deadline_ms) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+    if (wheel->occupied[0] != 0) {
+        // Level 0 holds one slot per tick, so this one is exact
+        uint64_t bits = rotate_right(wheel->occupied[0], TW_INDEX(wheel->current_ms, 0));
+        deadline = wheel->current_ms + (uint64_t)__builtin_ctzll(bits);
+    }
+
+    for (unsigned char level = 1; level < UB4J_TW_LEVELS; level++) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+        // Find the next slot that will be cascaded. Unless we're sitting right on its boundary, the
+        // current slot has already been cascaded and is only reached again after a full rotation.
+        unsigned int shift = UB4J_TW_BITS * level;
+        uint64_t bits = rotate_right(wheel->occupied[level], TW_INDEX(wheel->current_ms, level));
+        if ((wheel->current_ms & (((uint64_t)1 << shift) - 1)) != 0) {
+            bits &= ~(uint64_t)1;
+        }
+        uint64_t offset = bits != 0 ? (uint64_t)__builtin_ctzll(bits) : UB4J_TW_SLOTS;
+        uint64_t cascade_at = ((wheel->current_ms >> shift) + offset) << shift;
+        if (cascade_at < deadline) {
+            deadline = cascade_at;
+        }
+    }
+
+    *deadline_ms = deadline;
+    return 0;
+}
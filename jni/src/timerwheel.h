@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019, The OpenNMS Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UNBOUND4J_TIMERWHEEL_H
+#define UNBOUND4J_TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel with a resolution of 1 ms.
+ *
+ * Level 0 has one slot per millisecond, and every level above it covers 64 times the
+ * span of the one below: 64 ms, ~4 s, ~4.5 min and ~4.7 h. Timers are moved down a level
+ * when the wheel below wraps around, so adding, removing and expiring a timer are all
+ * O(1) amortized. Deadlines beyond the span of the wheel are parked on the top level
+ * and filed again each time it comes around.
+ *
+ * Timers are intrusive, the wheel never allocates. The wheel does no locking of its own.
+ */
+
+#define UB4J_TW_BITS 6
+#define UB4J_TW_SLOTS (1 << UB4J_TW_BITS)
+#define UB4J_TW_LEVELS 4
+
+struct ub4j_timer {
+    struct ub4j_timer* next;
+    struct ub4j_timer** pprev; // NULL when the timer is not scheduled
+    uint64_t expires_ms;
+    unsigned char level;
+    unsigned char slot;
+};
+
+struct ub4j_timer_wheel {
+    uint64_t current_ms; // next tick to be processed
+    size_t count;
+    uint64_t occupied[UB4J_TW_LEVELS]; // one bit per non-empty slot
+    struct ub4j_timer* slots[UB4J_TW_LEVELS][UB4J_TW_SLOTS];
+};
+
+void ub4j_timer_wheel_init(struct ub4j_timer_wheel* wheel, uint64_t now_ms);
+
+void ub4j_timer_add(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer, uint64_t expires_ms);
+
+void ub4j_timer_remove(struct ub4j_timer_wheel* wheel, struct ub4j_timer* timer);
+
+/**
+ * Advances the wheel up to and including now_ms and returns the timers that expired,
+ * chained through their next pointer. These are no longer scheduled.
+ */
+struct ub4j_timer* ub4j_timer_wheel_advance(struct ub4j_timer_wheel* wheel, uint64_t now_ms);
+
+/**
+ * Returns 0 and stores the time at which the wheel next needs to be advanced in deadline_ms,
+ * or returns -1 if there are no timers scheduled. The deadline is never later than the
+ * earliest timer, but it may be earlier if timers need to be moved down a level first.
+ */
+int ub4j_timer_wheel_next_deadline(struct ub4j_timer_wheel* wheel, uint64_t* deadline_ms);
+
+#endif //UNBOUND4J_TIMERWHEEL_H
@@ -18,46 +18,95 @@
 #include <stdio.h>
 #include <unbound.h>
 #include <stdatomic.h>
-#include <sys/time.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
 
 #include "uthash.h"
 #include "unbound4j.h"
 #include "sldns.h"
 #include "dnsutils.h"
+#include "timeutils.h"
 #include "log.h"
 
 struct ub4j_query {
+    struct ub4j_mpsc_node node; // links the query in the shard's submission queue
     int id;
+    struct ub4j_shard* shard;
+    struct ub4j_addr_key key;
+    uint64_t submitted_ms;
     void* userdata;
     ub4j_callback_type callback;
-    __time_t expires_at_epoch_sec;
+    struct ub4j_query* waiters; // lookups for the same address that were attached to this query
+    struct ub4j_timer timer;
     unsigned char expired;
-    UT_hash_handle hh; // makes this structure hashable
+    unsigned char probe; // a probe for the delegation of the prefix in key, see probe_delegation()
+    unsigned char refresh; // resolves key again to refresh its cache entry, see refresh_entry()
+    struct ub4j_query* next; // used to chain waiters
 };
 
+
+// Maximum number of delegation probes in flight on a shard
+#define UB4J_MAX_PROBES 256
+
+// Prefixes whose reverse zones are probed, i.e. the /24 for IPv4 and the /48 for IPv6, and the number
+// of labels in their reverse lookup domain (c.b.a.in-addr.arpa and 12 nibbles followed by ip6.arpa)
+#define UB4J_V4_PROBE_PREFIX_LEN 120
+#define UB4J_V4_PROBE_LABELS 5
+#define UB4J_V6_PROBE_PREFIX_LEN 48
+#define UB4J_V6_PROBE_LABELS 14
+
+#define query_from_timer(t) ((struct ub4j_query*)((char*)(t) - offsetof(struct ub4j_query, timer)))
+#define query_from_node(n) ((struct ub4j_query*)((char*)(n) - offsetof(struct ub4j_query, node)))
+
 struct ub4j_context *g_contexts = NULL;
 atomic_int g_ctx_id_generator = ATOMIC_VAR_INIT(1);
 
-struct ub4j_query *g_queries = NULL;
-
 pthread_rwlock_t g_ctx_lock;
-pthread_rwlock_t g_query_lock;
 pthread_mutex_t g_cfg_lock;
 
+ub4j_thread_hook_type g_thread_start_hook = NULL;
+ub4j_thread_hook_type g_thread_stop_hook = NULL;
+
 void ub4j_init() {
     if (pthread_rwlock_init(&g_ctx_lock, NULL) != 0) {
         log_fatal("unbound4j: Error while initializing context read-write lock.");
     }
 
-    if (pthread_rwlock_init(&g_query_lock, NULL) != 0) {
-        log_fatal("unbound4j: Error while initializing query read-write lock.");
-    }
-
     if (pthread_mutex_init(&g_cfg_lock, NULL) != 0) {
         log_fatal("unbound4j: Error while initializing configuration lock.");
     }
 }
 
+const char* ub4j_strerror(enum ub4j_status status) {
+    switch (status) {
+        case UB4J_STATUS_OK:
+            return "No error.";
+        case UB4J_STATUS_TIMEOUT:
+            return "Query timed out.";
+        case UB4J_STATUS_REJECTED:
+            return "Too many outstanding queries on context.";
+        case UB4J_STATUS_INVALID_ADDRESS:
+            return "Invalid IP address.";
+        case UB4J_STATUS_INVALID_CONTEXT:
+            return "Invalid context id.";
+        case UB4J_STATUS_RESOLVER_ERROR:
+            return "Resolver error.";
+        case UB4J_STATUS_STALE:
+            return "Answered with stale data.";
+        case UB4J_STATUS_NOT_ADMITTED:
+            return "Not resolved, address not seen often enough.";
+        default:
+            return "Internal error.";
+    }
+}
+
+void ub4j_set_thread_hooks(ub4j_thread_hook_type on_start, ub4j_thread_hook_type on_stop) {
+    g_thread_start_hook = on_start;
+    g_thread_stop_hook = on_stop;
+}
+
 int ub4j_free_context(struct ub4j_context *ctx, char* error, size_t error_len);
 
 void ub4j_destroy() {
@@ -84,96 +133,517 @@ void ub4j_destroy() {
 }
 
 void ub4j_config_init(struct ub4j_config* config) {
-    config->request_timeout_secs = 5;
+    config->request_timeout_ms = 5000;
     config->use_system_resolver = 1;
     config->unbound_config = NULL;
+    config->max_inflight_queries = 100000;
+    config->shards = 1;
+    config->cache_capacity = 0;
+    config->cache_max_ttl_secs = 86400;
+    config->cache_nxdomain_ttl_secs = 900;
+    config->cache_servfail_ttl_secs = 60;
+    config->cache_timeout_ttl_secs = 60;
+    config->cache_refresh_percent = 0;
+    config->cache_refresh_min_hits = 2;
+    config->cache_refresh_max_per_sec = 100;
+    config->cache_max_stale_secs = 0;
+    config->negative_prefix_cache_capacity = 0;
+    config->special_purpose_rules = 0;
+    config->prefix_rules = NULL;
+    config->prefix_rule_count = 0;
+    config->overrides_file = NULL;
+    config->cache_snapshot_file = NULL;
+    config->cache_snapshot_interval_secs = 0;
+    config->shared_cache_name = NULL;
+    config->shared_cache_capacity = 0;
+    config->admission_min_hits = 0;
+    config->admission_window_secs = 60;
+    config->admission_sketch_width = 1 << 20;
+    config->memory_budget_bytes = 0;
 }
 
-void* context_processing_thread(void *arg);
+void* shard_processing_thread(void *arg);
 
-struct ub4j_context* ub4j_create_context(struct ub4j_config* config, char* error, size_t error_len) {
+/**
+ * Creates the Unbound context for the shard, along with everything we need to track its queries.
+ * The processing thread is started separately.
+ */
+static int init_shard(struct ub4j_context* ctx, struct ub4j_shard* shard, int index, struct ub4j_config* config, char* error, size_t error_len) {
     int retval;
-    struct ub4j_context *ctx = malloc(sizeof(struct ub4j_context));
-    if (ctx == NULL) {
-        snprintf(error, error_len, "Failed to allocate memory for context.");
-        return NULL;
+    shard->ctx = ctx;
+    shard->index = index;
+    shard->evloop.wake_read_fd = -1;
+
+    // Preallocate the table used to track the in-flight queries, splitting the limit evenly across the shards
+    size_t max_queries = ((size_t)config->max_inflight_queries + config->shards - 1) / config->shards;
+    if (ub4j_inflight_init(&shard->queries, max_queries)) {
+        snprintf(error, error_len, "Failed to allocate memory for query tracking.");
+        return -1;
+    }
+    if (ub4j_pending_init(&shard->queries_by_addr, max_queries)) {
+        ub4j_inflight_free(&shard->queries);
+        snprintf(error, error_len, "Failed to allocate memory for query tracking.");
+        return -1;
+    }
+    if (ub4j_pending_init(&shard->probes, UB4J_MAX_PROBES)) {
+        ub4j_inflight_free(&shard->queries);
+        ub4j_pending_free(&shard->queries_by_addr);
+        snprintf(error, error_len, "Failed to allocate memory for query tracking.");
+        return -1;
+    }
+    ub4j_timer_wheel_init(&shard->timers, ub4j_monotonic_ms());
+    ub4j_mpsc_init(&shard->submissions);
+    atomic_init(&shard->outstanding, 0);
+    shard->max_outstanding = (int)max_queries;
+    if (ub4j_slab_init(&shard->query_records, sizeof(struct ub4j_query), (uint32_t)max_queries)) {
+        ub4j_inflight_free(&shard->queries);
+        ub4j_pending_free(&shard->queries_by_addr);
+        ub4j_pending_free(&shard->probes);
+        snprintf(error, error_len, "Failed to allocate memory for query tracking.");
+        return -1;
     }
-    memset(ctx, 0, sizeof(struct ub4j_context));
 
-    ctx->ub_ctx = ub_ctx_create();
-    if(!ctx->ub_ctx) {
-        free(ctx);
+    shard->ub_ctx = ub_ctx_create();
+    if(!shard->ub_ctx) {
         snprintf(error, error_len, "Could not create Unbound context.");
-        return NULL;
+        return -1;
     }
 
     if (config->use_system_resolver) {
         // Read /etc/resolv.conf for DNS proxy settings
-        if( (retval=ub_ctx_resolvconf(ctx->ub_ctx, "/etc/resolv.conf")) != 0) {
+        if( (retval=ub_ctx_resolvconf(shard->ub_ctx, "/etc/resolv.conf")) != 0) {
             snprintf(error, error_len, "Error reading resolv.conf: %s", ub_strerror(retval));
-            ub_ctx_delete(ctx->ub_ctx);
-            return NULL;
+            return -1;
         }
 
         // Read /etc/hosts for locally supplied host addresses
-        if( (retval=ub_ctx_hosts(ctx->ub_ctx, "/etc/hosts")) != 0) {
+        if( (retval=ub_ctx_hosts(shard->ub_ctx, "/etc/hosts")) != 0) {
             snprintf(error, error_len, "Error reading hosts: %s", ub_strerror(retval));
-            return NULL;
+            return -1;
         }
     } else if (config->unbound_config != NULL) {
         // Loading the configuration this way is not thread safe, so let's make sure we're only loading one at a time
         pthread_mutex_lock(&g_cfg_lock);
-        if( (retval=ub_ctx_config(ctx->ub_ctx, config->unbound_config)) != 0) {
+        if( (retval=ub_ctx_config(shard->ub_ctx, config->unbound_config)) != 0) {
             pthread_mutex_unlock(&g_cfg_lock);
             snprintf(error, error_len, "Error reading Unbound configuration from '%s': %s", config->unbound_config, ub_strerror(retval));
-            ub_ctx_delete(ctx->ub_ctx);
-            return NULL;
+            return -1;
         }
         pthread_mutex_unlock(&g_cfg_lock);
     }
 
     // Enable debugging
-    // ub_ctx_debuglevel(ctx->ub_ctx, 3);
+    // ub_ctx_debuglevel(shard->ub_ctx, 3);
 
     // Use a thread instead of forking
-    if (ub_ctx_async(ctx->ub_ctx, 1)) {
+    if (ub_ctx_async(shard->ub_ctx, 1)) {
         snprintf(error, error_len, "Failed to configure asynchronous behaviour on Unbound context.");
-        ub_ctx_delete(ctx->ub_ctx);
-        return NULL;
+        return -1;
     }
 
-    ctx->ub_fd = ub_fd(ctx->ub_ctx);
-    if (ctx->ub_fd < 0) {
+    shard->ub_fd = ub_fd(shard->ub_ctx);
+    if (shard->ub_fd < 0) {
         snprintf(error, error_len, "Failed to acquire file description from Unbound context.");
-        ub_ctx_delete(ctx->ub_ctx);
+        return -1;
+    }
+
+    // Watch Unbound's descriptor, and allow ourselves to be woken up for new deadlines and shutdown
+    if (ub4j_evloop_init(&shard->evloop, shard->ub_fd)) {
+        snprintf(error, error_len, "Failed to create event loop for context.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stops the shard's processing thread, if it was started, and frees everything held by the shard.
+ */
+static int free_shard(struct ub4j_shard* shard, char* error, size_t error_len) {
+    int nret = 0;
+
+    if (shard->thread_started) {
+        ub4j_evloop_wake(&shard->evloop);
+        if (pthread_join(shard->thread_id, NULL)) {
+            snprintf(error, error_len, "Error on join for processing thread.");
+            nret = -1;
+        }
+        shard->thread_started = 0;
+    }
+
+    if (shard->evloop.wake_read_fd >= 0) {
+        ub4j_evloop_free(&shard->evloop);
+    }
+    if (shard->ub_ctx) {
+        // Delete the Unbound context
+        ub_ctx_delete(shard->ub_ctx);
+        shard->ub_ctx = NULL;
+    }
+    if (shard->queries.slots != NULL) {
+        // Free up the query tracking
+        ub4j_inflight_free(&shard->queries);
+        ub4j_pending_free(&shard->queries_by_addr);
+        ub4j_pending_free(&shard->probes);
+        ub4j_slab_free(&shard->query_records);
+    }
+    return nret;
+}
+
+static void free_shards(struct ub4j_context* ctx) {
+    char error[256];
+    ctx->stopping = 1;
+    for (int i = 0; i < ctx->shard_count; i++) {
+        if (free_shard(&ctx->shards[i], error, sizeof(error))) {
+            log_error("unbound4j: Freeing shard %d failed: %s", i, error);
+        }
+    }
+    free(ctx->shards);
+    ctx->shards = NULL;
+}
+
+static void write_snapshot(struct ub4j_context* ctx) {
+    char error[256];
+    uint64_t start_ms = ub4j_monotonic_ms();
+    long count = ub4j_cache_save(&ctx->cache, ctx->cache_snapshot_file, start_ms, error, sizeof(error));
+    if (count < 0) {
+        log_warn("unbound4j: Writing cache snapshot for context with id:%d failed: %s", ctx->id, error);
+        return;
+    }
+    log_debug("unbound4j: Wrote %ld entries to cache snapshot for context with id:%d in %llu ms", count, ctx->id,
+              (unsigned long long)(ub4j_monotonic_ms() - start_ms));
+}
+
+static void load_snapshot(struct ub4j_context* ctx) {
+    // A snapshot that can't be read only costs us a cold cache, so don't fail the context over it
+    char error[256];
+    long count = ub4j_cache_load(&ctx->cache, ctx->cache_snapshot_file, ub4j_monotonic_ms(), error, sizeof(error));
+    if (count < 0) {
+        log_warn("unbound4j: Loading cache snapshot failed: %s", error);
+        return;
+    }
+    log_debug("unbound4j: Loaded %ld entries from cache snapshot %s", count, ctx->cache_snapshot_file);
+}
+
+void* snapshot_processing_thread(void *arg) {
+    struct ub4j_context* ctx = (struct ub4j_context*)arg;
+    pthread_mutex_lock(&ctx->snapshot_lock);
+    while (!ctx->snapshot_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ctx->cache_snapshot_interval_secs;
+        while (!ctx->snapshot_stopping) {
+            if (pthread_cond_timedwait(&ctx->snapshot_stop, &ctx->snapshot_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (ctx->snapshot_stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&ctx->snapshot_lock);
+        write_snapshot(ctx);
+        pthread_mutex_lock(&ctx->snapshot_lock);
+    }
+    pthread_mutex_unlock(&ctx->snapshot_lock);
+    return NULL;
+}
+
+static int start_snapshot_thread(struct ub4j_context* ctx) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&ctx->snapshot_lock, NULL) != 0 || pthread_cond_init(&ctx->snapshot_stop, &attr) != 0) {
+        pthread_condattr_destroy(&attr);
+        return -1;
+    }
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&ctx->snapshot_thread_id, NULL, snapshot_processing_thread, ctx)) {
+        pthread_cond_destroy(&ctx->snapshot_stop);
+        pthread_mutex_destroy(&ctx->snapshot_lock);
+        return -1;
+    }
+    ctx->snapshot_thread_started = 1;
+    return 0;
+}
+
+static void stop_snapshot_thread(struct ub4j_context* ctx) {
+    if (!ctx->snapshot_thread_started) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->snapshot_lock);
+    ctx->snapshot_stopping = 1;
+    pthread_cond_signal(&ctx->snapshot_stop);
+    pthread_mutex_unlock(&ctx->snapshot_lock);
+    pthread_join(ctx->snapshot_thread_id, NULL);
+    pthread_cond_destroy(&ctx->snapshot_stop);
+    pthread_mutex_destroy(&ctx->snapshot_lock);
+    ctx->snapshot_thread_started = 0;
+}
+
+/**
+ * Adds up the memory held by the context, by category.
+ */
+static void get_memory_usage(struct ub4j_context* ctx, struct ub4j_stats* stats) {
+    stats->inflight_bytes = 0;
+    for (int i = 0; i < ctx->shard_count; i++) {
+        struct ub4j_shard* shard = &ctx->shards[i];
+        stats->inflight_bytes += ub4j_slab_size(&shard->query_records) + ub4j_inflight_size(&shard->queries) +
+                                 ub4j_pending_size(&shard->queries_by_addr) + ub4j_pending_size(&shard->probes);
+    }
+    stats->cache_bytes = ub4j_cache_size(&ctx->cache);
+    stats->hostname_bytes = ctx->cache_enabled ? atomic_load_explicit(&ctx->cache.hostname_bytes, memory_order_relaxed) : 0;
+    stats->other_bytes = ub4j_cache_size(&ctx->prefix_cache) + ub4j_admission_size(&ctx->admission);
+}
+
+/**
+ * Checks that everything that was allocated up front fits in the budget, and leaves the rest of it
+ * to the hostnames that are copied to the heap as they're cached.
+ */
+static int apply_memory_budget(struct ub4j_context* ctx, uint64_t budget_bytes, char* error, size_t error_len) {
+    struct ub4j_stats usage;
+    get_memory_usage(ctx, &usage);
+    uint64_t reserved_bytes = usage.inflight_bytes + usage.cache_bytes + usage.other_bytes;
+    if (reserved_bytes > budget_bytes) {
+        snprintf(error, error_len, "Memory budget of %llu bytes is too small: %llu bytes are needed for the in-flight queries, "
+                 "%llu for the cache and %llu for the rest.", (unsigned long long)budget_bytes, (unsigned long long)usage.inflight_bytes,
+                 (unsigned long long)usage.cache_bytes, (unsigned long long)usage.other_bytes);
+        return -1;
+    }
+    if (ctx->cache_enabled) {
+        ub4j_cache_limit_hostnames(&ctx->cache, budget_bytes - reserved_bytes);
+    }
+    return 0;
+}
+
+struct ub4j_context* ub4j_create_context(struct ub4j_config* config, char* error, size_t error_len) {
+    if (config->request_timeout_ms <= 0) {
+        snprintf(error, error_len, "Invalid request timeout: %d ms", config->request_timeout_ms);
         return NULL;
     }
 
-    // Spawn the thread
-    if (pthread_create(&(ctx->thread_id), NULL, context_processing_thread, ctx)) {
-        snprintf(error, error_len, "Failed to create processing thread for context.");
-        ub_ctx_delete(ctx->ub_ctx);
+    if (config->max_inflight_queries <= 0) {
+        snprintf(error, error_len, "Invalid maximum number of in-flight queries: %d", config->max_inflight_queries);
         return NULL;
     }
 
-    // Generate a unique context id
-    ctx->id = atomic_fetch_add(&g_ctx_id_generator, 1);
+    if (config->cache_refresh_percent < 0 || config->cache_refresh_percent >= 100) {
+        snprintf(error, error_len, "Invalid cache refresh percentage: %d", config->cache_refresh_percent);
+        return NULL;
+    }
+
+    if (config->cache_refresh_percent > 0 && (config->cache_refresh_min_hits < 0 || config->cache_refresh_max_per_sec <= 0)) {
+        snprintf(error, error_len, "Invalid cache refresh budget: %d hits, %d per second", config->cache_refresh_min_hits,
+                 config->cache_refresh_max_per_sec);
+        return NULL;
+    }
+
+    if (config->cache_max_stale_secs < 0) {
+        snprintf(error, error_len, "Invalid maximum staleness: %d s", config->cache_max_stale_secs);
+        return NULL;
+    }
+
+    if (config->admission_min_hits < 0 || config->admission_min_hits > UCHAR_MAX) {
+        snprintf(error, error_len, "Invalid admission threshold: %d hits", config->admission_min_hits);
+        return NULL;
+    }
+
+    if (config->admission_min_hits > 0 && (config->admission_window_secs <= 0 || config->admission_sketch_width <= 0)) {
+        snprintf(error, error_len, "Invalid admission filter: %d s window, %d counters", config->admission_window_secs,
+                 config->admission_sketch_width);
+        return NULL;
+    }
+
+    if (config->memory_budget_bytes < 0) {
+        snprintf(error, error_len, "Invalid memory budget: %lld bytes", (long long)config->memory_budget_bytes);
+        return NULL;
+    }
+
+    if (config->cache_snapshot_interval_secs < 0) {
+        snprintf(error, error_len, "Invalid cache snapshot interval: %d s", config->cache_snapshot_interval_secs);
+        return NULL;
+    }
+
+    if (config->shared_cache_name != NULL && config->shared_cache_capacity <= 0) {
+        snprintf(error, error_len, "Invalid shared cache capacity: %d", config->shared_cache_capacity);
+        return NULL;
+    }
+
+    if (config->shards <= 0) {
+        snprintf(error, error_len, "Invalid number of shards: %d", config->shards);
+        return NULL;
+    }
+
+    if (config->cache_capacity < 0) {
+        snprintf(error, error_len, "Invalid cache capacity: %d", config->cache_capacity);
+        return NULL;
+    }
+
+    if (config->negative_prefix_cache_capacity < 0) {
+        snprintf(error, error_len, "Invalid negative prefix cache capacity: %d", config->negative_prefix_cache_capacity);
+        return NULL;
+    }
+
+    if (config->cache_max_ttl_secs < 0 || config->cache_nxdomain_ttl_secs < 0 ||
+        config->cache_servfail_ttl_secs < 0 || config->cache_timeout_ttl_secs < 0) {
+        snprintf(error, error_len, "Invalid cache TTL: TTLs cannot be negative.");
+        return NULL;
+    }
+
+    struct ub4j_context *ctx = malloc(sizeof(struct ub4j_context));
+    if (ctx == NULL) {
+        snprintf(error, error_len, "Failed to allocate memory for context.");
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(struct ub4j_context));
+
+    ctx->shards = calloc((size_t)config->shards, sizeof(struct ub4j_shard));
+    if (ctx->shards == NULL) {
+        free(ctx);
+        snprintf(error, error_len, "Failed to allocate memory for shards.");
+        return NULL;
+    }
 
     // Store the configuration settings that we'll need later
-    ctx->request_timeout_secs = config->request_timeout_secs;
+    ctx->request_timeout_ms = config->request_timeout_ms;
+
+    if (config->cache_capacity > 0) {
+        if (ub4j_cache_init(&ctx->cache, (size_t)config->cache_capacity, (uint32_t)config->cache_max_ttl_secs)) {
+            free(ctx->shards);
+            free(ctx);
+            snprintf(error, error_len, "Failed to allocate memory for cache.");
+            return NULL;
+        }
+        ctx->cache_enabled = 1;
+        if (config->cache_refresh_percent > 0) {
+            ub4j_cache_enable_refresh(&ctx->cache, config->cache_refresh_percent, (uint32_t)config->cache_refresh_min_hits);
+        }
+        if (config->cache_max_stale_secs > 0) {
+            ub4j_cache_enable_stale(&ctx->cache, (uint32_t)config->cache_max_stale_secs);
+        }
+    }
+    ctx->cache_refresh_max_per_sec = config->cache_refresh_max_per_sec;
+    atomic_init(&ctx->refresh_window, 0);
+    ctx->cache_nxdomain_ttl_secs = (uint32_t)config->cache_nxdomain_ttl_secs;
+    ctx->cache_servfail_ttl_secs = (uint32_t)config->cache_servfail_ttl_secs;
+    ctx->cache_timeout_ttl_secs = (uint32_t)config->cache_timeout_ttl_secs;
+
+    if (config->negative_prefix_cache_capacity > 0) {
+        if (ub4j_cache_init(&ctx->prefix_cache, (size_t)config->negative_prefix_cache_capacity, (uint32_t)config->cache_max_ttl_secs)) {
+            ub4j_cache_free(&ctx->cache);
+            free(ctx->shards);
+            free(ctx);
+            snprintf(error, error_len, "Failed to allocate memory for negative prefix cache.");
+            return NULL;
+        }
+        ctx->prefix_cache_enabled = 1;
+    }
+
+    if (config->special_purpose_rules || config->prefix_rule_count > 0) {
+        if (ub4j_rule_table_init(&ctx->rules, config->prefix_rules, config->prefix_rule_count,
+                                 config->special_purpose_rules, error, error_len)) {
+            ub4j_cache_free(&ctx->cache);
+            ub4j_cache_free(&ctx->prefix_cache);
+            free(ctx->shards);
+            free(ctx);
+            return NULL;
+        }
+        ctx->rules_enabled = 1;
+    }
+
+    if (config->overrides_file != NULL) {
+        ctx->overrides = ub4j_overrides_open(config->overrides_file, error, error_len);
+        if (ctx->overrides == NULL) {
+            ub4j_cache_free(&ctx->cache);
+            ub4j_cache_free(&ctx->prefix_cache);
+            ub4j_rule_table_free(&ctx->rules);
+            free(ctx->shards);
+            free(ctx);
+            return NULL;
+        }
+    }
+
+    if (config->shared_cache_name != NULL) {
+        ctx->shared_cache = ub4j_shm_cache_attach(config->shared_cache_name, (size_t)config->shared_cache_capacity,
+                                                  (uint32_t)config->cache_max_ttl_secs, error, error_len);
+        if (ctx->shared_cache == NULL) {
+            goto error;
+        }
+    }
+
+    if (config->admission_min_hits > 0) {
+        if (ub4j_admission_init(&ctx->admission, (size_t)config->admission_sketch_width, (uint8_t)config->admission_min_hits,
+                                (uint32_t)config->admission_window_secs, ub4j_monotonic_ms(), error, error_len)) {
+            goto error;
+        }
+        ctx->admission_enabled = 1;
+    }
+
+    if (ctx->cache_enabled && config->cache_snapshot_file != NULL) {
+        ctx->cache_snapshot_file = strdup(config->cache_snapshot_file);
+        if (ctx->cache_snapshot_file == NULL) {
+            snprintf(error, error_len, "Failed to allocate memory for cache snapshot path.");
+            goto error;
+        }
+        ctx->cache_snapshot_interval_secs = config->cache_snapshot_interval_secs;
+    }
+
+    // Create the shards
+    for (int i = 0; i < config->shards; i++) {
+        ctx->shard_count = i + 1;
+        if (init_shard(ctx, &ctx->shards[i], i, config, error, error_len)) {
+            goto error;
+        }
+    }
+
+    // The snapshot may hold long hostnames, so it's only loaded once their share of the budget is known
+    if (config->memory_budget_bytes > 0 && apply_memory_budget(ctx, (uint64_t)config->memory_budget_bytes, error, error_len)) {
+        goto error;
+    }
+    if (ctx->cache_snapshot_file != NULL) {
+        load_snapshot(ctx);
+    }
+
+    // Spawn the threads
+    for (int i = 0; i < ctx->shard_count; i++) {
+        struct ub4j_shard* shard = &ctx->shards[i];
+        if (pthread_create(&(shard->thread_id), NULL, shard_processing_thread, shard)) {
+            snprintf(error, error_len, "Failed to create processing thread for context.");
+            goto error;
+        }
+        shard->thread_started = 1;
+    }
+    if (ctx->cache_snapshot_file != NULL && ctx->cache_snapshot_interval_secs > 0 && start_snapshot_thread(ctx)) {
+        snprintf(error, error_len, "Failed to create cache snapshot thread for context.");
+        goto error;
+    }
+
+    // Generate a unique context id
+    ctx->id = atomic_fetch_add(&g_ctx_id_generator, 1);
 
     // Store the context
     if (pthread_rwlock_wrlock(&g_ctx_lock) != 0) {
         snprintf(error, error_len, "Failed to acquire write lock.");
-        ctx->stopping = 1; // Stop the thread
-        ub_ctx_delete(ctx->ub_ctx);
-        return NULL;
+        goto error;
     }
 
     HASH_ADD_INT(g_contexts, id, ctx);
     pthread_rwlock_unlock(&g_ctx_lock);
-    log_debug("unbound4j: Successfully created unbound4j context with id:%d", ctx->id);
+    log_debug("unbound4j: Successfully created unbound4j context with id:%d and %d shard(s)", ctx->id, ctx->shard_count);
     return ctx;
+
+    error:
+        // Stops any threads that were started
+        stop_snapshot_thread(ctx);
+        free_shards(ctx);
+        free(ctx->cache_snapshot_file);
+        ub4j_cache_free(&ctx->cache);
+        ub4j_cache_free(&ctx->prefix_cache);
+        ub4j_shm_cache_detach(ctx->shared_cache);
+        ub4j_admission_free(&ctx->admission);
+        ub4j_rule_table_free(&ctx->rules);
+        ub4j_overrides_close(ctx->overrides);
+        free(ctx);
+        return NULL;
 }
 
 int ub4j_delete_context(int ctx_id, char* error, size_t error_len) {
@@ -205,41 +675,323 @@ int ub4j_delete_context(int ctx_id, char* error, size_t error_len) {
 int ub4j_free_context(struct ub4j_context *ctx, char* error, size_t error_len) {
     int nret = 0;
 
-    // Stop the thread and join
+    // Stop the threads and join
+    stop_snapshot_thread(ctx);
     ctx->stopping = 1;
-    log_debug("unbound4j: Waiting on context thread to complete for context with id:%d", ctx->id);
-    if (pthread_join(ctx->thread_id, NULL)) {
-        snprintf(error, error_len, "Error on join for processing thread.");
-        nret = -1;
+    log_debug("unbound4j: Waiting on context threads to complete for context with id:%d", ctx->id);
+    for (int i = 0; i < ctx->shard_count; i++) {
+        if (free_shard(&ctx->shards[i], error, error_len)) {
+            nret = -1;
+        }
+    }
+
+    // Now that nothing else touches the cache, write out its final state
+    if (ctx->cache_snapshot_file != NULL) {
+        write_snapshot(ctx);
     }
 
-    // Delete the Unbound context
-    ub_ctx_delete(ctx->ub_ctx);
     // Free up the ub4j context structure
+    free(ctx->shards);
+    free(ctx->cache_snapshot_file);
+    ub4j_cache_free(&ctx->cache);
+    ub4j_cache_free(&ctx->prefix_cache);
+    ub4j_shm_cache_detach(ctx->shared_cache);
+    ub4j_admission_free(&ctx->admission);
+    ub4j_rule_table_free(&ctx->rules);
+    ub4j_overrides_close(ctx->overrides);
     free(ctx);
     return nret;
 }
 
+int ub4j_get_stats(int ctx_id, struct ub4j_stats* stats, char* error, size_t error_len) {
+    if (pthread_rwlock_rdlock(&g_ctx_lock) != 0) {
+        snprintf(error, error_len, "Failed to acquire read lock.");
+        return -1;
+    }
+
+    int id = ctx_id;
+    struct ub4j_context *ctx = NULL;
+    HASH_FIND_INT(g_contexts, &id, ctx);
+    if (ctx == NULL) {
+        pthread_rwlock_unlock(&g_ctx_lock);
+        snprintf(error, error_len, "Invalid context id.");
+        return -1;
+    }
+
+    struct ub4j_context_counters* counters = &ctx->counters;
+    stats->lookups = atomic_load_explicit(&counters->lookups, memory_order_relaxed);
+    stats->cache_hits = atomic_load_explicit(&counters->cache_hits, memory_order_relaxed);
+    stats->coalesced = atomic_load_explicit(&counters->coalesced, memory_order_relaxed);
+    stats->queries_sent = atomic_load_explicit(&counters->queries_sent, memory_order_relaxed);
+    stats->rejected = atomic_load_explicit(&counters->rejected, memory_order_relaxed);
+    stats->timeouts = atomic_load_explicit(&counters->timeouts, memory_order_relaxed);
+    stats->short_circuited = atomic_load_explicit(&counters->short_circuited, memory_order_relaxed);
+    stats->override_hits = atomic_load_explicit(&counters->override_hits, memory_order_relaxed);
+    stats->shared_cache_hits = atomic_load_explicit(&counters->shared_cache_hits, memory_order_relaxed);
+    stats->refreshes = atomic_load_explicit(&counters->refreshes, memory_order_relaxed);
+    stats->stale_hits = atomic_load_explicit(&counters->stale_hits, memory_order_relaxed);
+    stats->not_admitted = atomic_load_explicit(&counters->not_admitted, memory_order_relaxed);
+    stats->hostname_allocations = ctx->cache_enabled ? atomic_load_explicit(&ctx->cache.allocations, memory_order_relaxed) : 0;
+    get_memory_usage(ctx, stats);
+
+    pthread_rwlock_unlock(&g_ctx_lock);
+    return 0;
+}
+
+int ub4j_set_overrides(int ctx_id, const char* path, char* error, size_t error_len) {
+    // Map the new file before taking the lock, this may take a while
+    struct ub4j_overrides* overrides = NULL;
+    if (path != NULL) {
+        overrides = ub4j_overrides_open(path, error, error_len);
+        if (overrides == NULL) {
+            return -1;
+        }
+    }
+
+    // Lookups hold the read lock while they use the overrides, so once we have the write lock
+    // we know that nobody is using the old ones
+    if (pthread_rwlock_wrlock(&g_ctx_lock) != 0) {
+        ub4j_overrides_close(overrides);
+        snprintf(error, error_len, "Failed to acquire write lock.");
+        return -1;
+    }
+
+    int id = ctx_id;
+    struct ub4j_context *ctx = NULL;
+    HASH_FIND_INT(g_contexts, &id, ctx);
+    if (ctx == NULL) {
+        pthread_rwlock_unlock(&g_ctx_lock);
+        ub4j_overrides_close(overrides);
+        snprintf(error, error_len, "Invalid context id.");
+        return -1;
+    }
+
+    struct ub4j_overrides* previous = ctx->overrides;
+    ctx->overrides = overrides;
+    pthread_rwlock_unlock(&g_ctx_lock);
+
+    ub4j_overrides_close(previous);
+    return 0;
+}
+
+#define count(ctx, counter) atomic_fetch_add_explicit(&(ctx)->counters.counter, 1, memory_order_relaxed)
+
+/**
+ * Maps the address to the shard that is responsible for it.
+ */
+static struct ub4j_shard* shard_for_addr(struct ub4j_context* ctx, const struct ub4j_addr_key* key) {
+    if (ctx->shard_count == 1) {
+        return &ctx->shards[0];
+    }
+    // Use the upper bits of the hash, the cache uses the lower ones to pick a set
+    return &ctx->shards[(ub4j_addr_key_hash(key) >> 32) % (uint32_t)ctx->shard_count];
+}
+
+/**
+ * Keeps the entry a refresh failed to replace, rather than replacing it with the failure, and tries again
+ * once the failure would have expired. Stale entries are served in the meantime.
+ */
+static void defer_refresh(struct ub4j_context* ctx, struct ub4j_query* query, uint32_t retry_secs) {
+    uint64_t now_ms = ub4j_monotonic_ms();
+    ub4j_cache_defer_refresh(&ctx->cache, &query->key, now_ms + (uint64_t)(retry_secs > 0 ? retry_secs : 1) * 1000, now_ms);
+}
+
+/**
+ * Remembers the outcome of the query, if it's one we cache.
+ */
+static void cache_result(struct ub4j_query* query, int err, struct ub_result* result, const char* hostname) {
+    struct ub4j_context* ctx = query->shard->ctx;
+    if ((!ctx->cache_enabled && ctx->shared_cache == NULL) || ctx->stopping) {
+        return;
+    }
+
+    enum ub4j_cache_outcome outcome;
+    uint32_t ttl_secs;
+    if (err != 0) {
+        if (query->refresh) {
+            defer_refresh(ctx, query, ctx->cache_timeout_ttl_secs);
+            return;
+        }
+        if (!query->expired) {
+            return;
+        }
+        outcome = UB4J_CACHE_TIMEOUT;
+        ttl_secs = ctx->cache_timeout_ttl_secs;
+    } else if (hostname != NULL) {
+        outcome = UB4J_CACHE_HOSTNAME;
+        ttl_secs = (uint32_t)result->ttl;
+    } else if (result->havedata) {
+        // We failed to copy the hostname
+        if (query->refresh) {
+            defer_refresh(ctx, query, ctx->cache_servfail_ttl_secs);
+        }
+        return;
+    } else if (result->nxdomain || result->rcode == 0) {
+        outcome = UB4J_CACHE_NO_DATA;
+        ttl_secs = ctx->cache_nxdomain_ttl_secs;
+        // Don't hold on to the negative answer for longer than the zone allows
+        uint32_t soa_ttl_secs;
+        if (!get_negative_ttl_from_soa(result->answer_packet, (size_t)result->answer_len, &soa_ttl_secs) &&
+            soa_ttl_secs < ttl_secs) {
+            ttl_secs = soa_ttl_secs;
+        }
+    } else if (query->refresh) {
+        defer_refresh(ctx, query, ctx->cache_servfail_ttl_secs);
+        return;
+    } else {
+        outcome = UB4J_CACHE_SERVFAIL;
+        ttl_secs = ctx->cache_servfail_ttl_secs;
+    }
+
+    uint64_t now_ms = ub4j_monotonic_ms();
+    if (ctx->cache_enabled) {
+        ub4j_cache_put(&ctx->cache, &query->key, outcome, hostname, ttl_secs, now_ms);
+    }
+    if (ctx->shared_cache != NULL) {
+        ub4j_shm_cache_put(ctx->shared_cache, &query->key, outcome, hostname, ttl_secs, now_ms);
+    }
+}
+
+/**
+ * Stops tracking the query. Once it's out of the tables, no more lookups can be attached to it.
+ */
+static void release_query(struct ub4j_shard* shard, struct ub4j_query* query) {
+    ub4j_slab_release(&shard->query_records, query);
+    atomic_fetch_sub_explicit(&shard->outstanding, 1, memory_order_relaxed);
+}
+
+static struct ub4j_pending_table* pending_table_for(struct ub4j_shard* shard, struct ub4j_query* query) {
+    return query->probe ? &shard->probes : &shard->queries_by_addr;
+}
+
+static void untrack_query(struct ub4j_shard* shard, struct ub4j_query* query) {
+    ub4j_inflight_remove(&shard->queries, query->id);
+    ub4j_pending_remove(pending_table_for(shard, query), &query->key);
+    ub4j_timer_remove(&shard->timers, &query->timer);
+}
+
+/**
+ * Issues the callback for the query, along with those of the lookups that were attached to it,
+ * and frees them all.
+ */
+static void complete_query(struct ub4j_query* query, enum ub4j_status status, const char* hostname) {
+    struct ub4j_shard* shard = query->shard;
+
+    // Fan the answer out to the attached lookups
+    struct ub4j_query* waiter = query->waiters;
+    while (waiter != NULL) {
+        struct ub4j_query* next = waiter->next;
+        waiter->callback(waiter->userdata, status, hostname);
+        release_query(shard, waiter);
+        waiter = next;
+    }
+
+    // Issue the delegate callback
+    query->callback(query->userdata, status, hostname);
+    release_query(shard, query);
+}
+
+static int probe_prefix_len(const struct ub4j_addr_key* key) {
+    return ub4j_addr_key_is_v4(key) ? UB4J_V4_PROBE_PREFIX_LEN : UB4J_V6_PROBE_PREFIX_LEN;
+}
+
+/**
+ * Called with an NXDOMAIN answer for the address. When the SOA that came with it shows that the
+ * zone that answered sits above the /24 (or /48) of the address, the reverse zone for the whole
+ * prefix may not exist. We then queue a query for the prefix's own reverse domain, and if that
+ * doesn't exist either (RFC 8020), none of the addresses in the prefix can be resolved.
+ */
+static void probe_delegation(struct ub4j_shard* shard, const struct ub4j_addr_key* key, struct ub_result* result, uint64_t now_ms) {
+    struct ub4j_context* ctx = shard->ctx;
+    if (!ctx->prefix_cache_enabled || ctx->stopping) {
+        return;
+    }
+
+    int soa_labels;
+    int is_v4 = ub4j_addr_key_is_v4(key);
+    if (get_soa_owner_label_count(result->answer_packet, (size_t)result->answer_len, &soa_labels) ||
+        soa_labels >= (is_v4 ? UB4J_V4_PROBE_LABELS : UB4J_V6_PROBE_LABELS)) {
+        // The prefix is delegated, only this address is missing
+        return;
+    }
+
+    struct ub4j_addr_key prefix;
+    ub4j_addr_key_mask(key, probe_prefix_len(key), &prefix);
+    if (shard->probes.count >= UB4J_MAX_PROBES || ub4j_pending_get(&shard->probes, &prefix) != NULL ||
+        ub4j_cache_get(&ctx->prefix_cache, &prefix, now_ms, NULL, 0, NULL) != UB4J_CACHE_MISS) {
+        return;
+    }
+
+    // Probes take up a spot like any other query, and are skipped when there's none left
+    if (atomic_fetch_add_explicit(&shard->outstanding, 1, memory_order_relaxed) >= shard->max_outstanding) {
+        atomic_fetch_sub_explicit(&shard->outstanding, 1, memory_order_relaxed);
+        return;
+    }
+    struct ub4j_query* probe = ub4j_slab_alloc(&shard->query_records);
+    memset(probe, 0, sizeof(struct ub4j_query));
+    probe->shard = shard;
+    probe->key = prefix;
+    probe->submitted_ms = now_ms;
+    probe->probe = 1;
+
+    // We're on the processing thread, the queue is drained once Unbound is done calling back
+    ub4j_mpsc_push(&shard->submissions, &probe->node);
+}
+
+static void complete_probe(struct ub4j_query* probe, int err, struct ub_result* result) {
+    struct ub4j_shard* shard = probe->shard;
+    struct ub4j_context* ctx = shard->ctx;
+
+    if (err == 0 && result != NULL && result->nxdomain && !ctx->stopping) {
+        // Nothing exists under the prefix's reverse domain
+        uint32_t ttl_secs = ctx->cache_nxdomain_ttl_secs;
+        uint32_t soa_ttl_secs;
+        if (!get_negative_ttl_from_soa(result->answer_packet, (size_t)result->answer_len, &soa_ttl_secs) &&
+            soa_ttl_secs < ttl_secs) {
+            ttl_secs = soa_ttl_secs;
+        }
+        ub4j_cache_put(&ctx->prefix_cache, &probe->key, UB4J_CACHE_NO_DATA, NULL, ttl_secs, ub4j_monotonic_ms());
+    }
+
+    if (result != NULL) {
+        ub_resolve_free(result);
+    }
+    if (!probe->expired) {
+        untrack_query(shard, probe);
+    }
+    release_query(shard, probe);
+}
+
 void ub_reverse_lookup_callback(void* mydata, int err, struct ub_result* result) {
     struct ub4j_query* query = (struct ub4j_query*)mydata;
+    if (query->probe) {
+        complete_probe(query, err, result);
+        return;
+    }
 
+    char hostname_buf[256]; // maximum length of a domain name is 253
     char* hostname = NULL;
     if (err == 0 && result != NULL) {
         if(result->havedata) {
-            size_t hostname_len = 256; // maximum length of a domain name is 253
-            hostname = malloc(hostname_len);
-            // TODO: Catch malloc failure
-            sldns_wire2str_rdata_buf((uint8_t *) result->data[0], (size_t) result->len[0], hostname, hostname_len,
+            hostname = hostname_buf;
+            sldns_wire2str_rdata_buf((uint8_t *) result->data[0], (size_t) result->len[0], hostname, sizeof(hostname_buf),
                                      (uint16_t) result->qtype);
         }
     }
 
-    const char* err_str  = NULL;
+    if (err != 0 || result != NULL) {
+        cache_result(query, err, result, hostname);
+    }
+    if (err == 0 && result != NULL && result->nxdomain) {
+        probe_delegation(query->shard, &query->key, result, ub4j_monotonic_ms());
+    }
+
+    enum ub4j_status status = UB4J_STATUS_OK;
     if (err != 0) {
         if (query->expired) {
-            err_str = "Query timed out.";
+            status = UB4J_STATUS_TIMEOUT;
         } else {
-            err_str = ub_strerror(err);
+            status = UB4J_STATUS_RESOLVER_ERROR;
         }
     }
 
@@ -247,196 +999,538 @@ void ub_reverse_lookup_callback(void* mydata, int err, struct ub_result* result)
         ub_resolve_free(result);
     }
 
-    // Issue the delegate callback
-    query->callback(query->userdata, err_str, hostname);
-
-    // Stop tracking the query
+    // Expired queries were already dropped from the tables
     if (!query->expired) {
-        if (!pthread_rwlock_wrlock(&g_query_lock)) {
-            HASH_DEL(g_queries, query);
-            pthread_rwlock_unlock(&g_query_lock);
+        untrack_query(query->shard, query);
+    }
+
+    complete_query(query, status, hostname);
+}
+
+/*
+ * The outcome of a lookup that was answered, or rejected, without being queued.
+ */
+struct ub4j_immediate_answer {
+    void* userdata;
+    enum ub4j_status status;
+    const char* hostname; // NULL, or points to hostname_buf
+    char hostname_buf[256];
+};
+
+/**
+ * Hands a query for the address over to the processing thread of the shard that's responsible for it.
+ *
+ * @return the query, or NULL if the shard has too many outstanding queries
+ */
+static struct ub4j_query* queue_query(struct ub4j_context* ctx, const struct ub4j_addr_key* key, uint64_t now_ms, void* userdata,
+                                      ub4j_callback_type callback, unsigned char refresh) {
+    struct ub4j_shard* shard = shard_for_addr(ctx, key);
+
+    // Reserve our spot on the shard
+    if (atomic_fetch_add_explicit(&shard->outstanding, 1, memory_order_relaxed) >= shard->max_outstanding) {
+        atomic_fetch_sub_explicit(&shard->outstanding, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    // Having reserved a spot, we're guaranteed to find a free record
+    struct ub4j_query* query = ub4j_slab_alloc(&shard->query_records);
+
+    memset(query, 0, sizeof(struct ub4j_query));
+    query->shard = shard;
+    query->key = *key;
+    query->submitted_ms = now_ms;
+    query->userdata = userdata;
+    query->callback = callback;
+    query->refresh = refresh;
+
+    // Hand the lookup over to the processing thread, which only needs to be woken up
+    // if it may have already gone back to waiting after draining the queue
+    if (ub4j_mpsc_push(&shard->submissions, &query->node)) {
+        ub4j_evloop_wake(&shard->evloop);
+    }
+    return query;
+}
+
+static void refresh_callback(void* userdata, enum ub4j_status status, const char* hostname) {
+    // The answer only matters to the cache, see cache_result()
+}
+
+/**
+ * Takes one of the refreshes allowed during the current second.
+ *
+ * @return 1 if one was available, 0 if the budget is spent
+ */
+static int take_refresh_budget(struct ub4j_context* ctx, uint64_t now_ms) {
+    uint64_t second = (now_ms / 1000) & 0xffffffffULL;
+    unsigned long long window = atomic_load_explicit(&ctx->refresh_window, memory_order_relaxed);
+    for (;;) {
+        unsigned long long next;
+        if ((window >> 32) != second) {
+            next = (second << 32) | 1;
+        } else if ((window & 0xffffffffULL) < (unsigned long long)ctx->cache_refresh_max_per_sec) {
+            next = window + 1;
         } else {
-            log_fatal("unbound4j: Failed to acquire write lock for query tracking.");
+            return 0;
+        }
+        if (atomic_compare_exchange_weak_explicit(&ctx->refresh_window, &window, next, memory_order_relaxed, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * Resolves the address of a cache entry again, in the background, so that a hot entry is replaced before
+ * it expires, or a stale one once the resolver answers. Entries that can't be refreshed within the budget,
+ * or while the shard is full, get another chance on their next hit.
+ */
+static void refresh_entry(struct ub4j_context* ctx, const struct ub4j_addr_key* key, uint64_t now_ms, short budgeted) {
+    if (!ub4j_cache_claim_refresh(&ctx->cache, key, now_ms)) {
+        return;
+    }
+    if ((budgeted && !take_refresh_budget(ctx, now_ms)) || queue_query(ctx, key, now_ms, NULL, refresh_callback, 1) == NULL) {
+        // Give the claim back
+        ub4j_cache_defer_refresh(&ctx->cache, key, now_ms, now_ms);
+        return;
+    }
+    count(ctx, refreshes);
+}
+
+static void answer_from_cache(enum ub4j_cache_outcome outcome, struct ub4j_immediate_answer* answer) {
+    if (outcome == UB4J_CACHE_HOSTNAME) {
+        answer->hostname = answer->hostname_buf;
+    } else if (outcome == UB4J_CACHE_TIMEOUT) {
+        answer->status = UB4J_STATUS_TIMEOUT;
+    }
+}
+
+/**
+ * Answers the lookup from the cache, or queues it on the shard that's responsible for the address.
+ * Must be called with the read lock held.
+ */
+static int resolve_locked(struct ub4j_context* ctx, const struct ub4j_addr_key* key, uint64_t now_ms, void* userdata,
+                          ub4j_callback_type callback, struct ub4j_immediate_answer* answer) {
+    count(ctx, lookups);
+
+    if (ctx->prefix_cache_enabled) {
+        // Nothing under the prefix can be resolved when its reverse zone doesn't exist
+        struct ub4j_addr_key prefix;
+        ub4j_addr_key_mask(key, probe_prefix_len(key), &prefix);
+        if (ub4j_cache_get(&ctx->prefix_cache, &prefix, now_ms, NULL, 0, NULL) == UB4J_CACHE_NO_DATA) {
+            count(ctx, cache_hits);
+            return 1;
+        }
+    }
+
+    if (ctx->cache_enabled) {
+        int flags = 0;
+        enum ub4j_cache_outcome outcome = ub4j_cache_get(&ctx->cache, key, now_ms, answer->hostname_buf, sizeof(answer->hostname_buf), &flags);
+        if (outcome != UB4J_CACHE_MISS) {
+            count(ctx, cache_hits);
+            answer_from_cache(outcome, answer);
+            if (flags & UB4J_CACHE_FLAG_STALE) {
+                count(ctx, stale_hits);
+                answer->status = UB4J_STATUS_STALE;
+            }
+            if (flags & UB4J_CACHE_FLAG_REFRESH) {
+                // Stale entries are resolved again regardless of the budget, there's at most one query for each
+                refresh_entry(ctx, key, now_ms, !(flags & UB4J_CACHE_FLAG_STALE));
+            }
+            return 1;
         }
     }
 
-    free(query);
+    if (ctx->shared_cache != NULL) {
+        enum ub4j_cache_outcome outcome = ub4j_shm_cache_get(ctx->shared_cache, key, now_ms, answer->hostname_buf, sizeof(answer->hostname_buf));
+        if (outcome != UB4J_CACHE_MISS) {
+            count(ctx, shared_cache_hits);
+            answer_from_cache(outcome, answer);
+            return 1;
+        }
+    }
+
+    // Only addresses that keep coming back are worth a query, and the cache entry that comes with it
+    if (ctx->admission_enabled && !ub4j_admission_record(&ctx->admission, key)) {
+        count(ctx, not_admitted);
+        answer->status = UB4J_STATUS_NOT_ADMITTED;
+        return 1;
+    }
+
+    if (queue_query(ctx, key, now_ms, userdata, callback, 0) == NULL) {
+        count(ctx, rejected);
+        answer->status = UB4J_STATUS_REJECTED;
+        return -1;
+    }
+    return 0;
 }
 
-int ub4j_reverse_lookup(int ctx_id, uint8_t* addr, size_t addr_len, void* userdata, ub4j_callback_type callback, char* error, size_t error_len) {
-    // Acquire a read lock
+/**
+ * Answers the lookup from the context's overrides, or applies its prefix rules and resolves it with the
+ * context the rule routes it to, if any, otherwise with the context itself. Must be called with the read
+ * lock held. The callback is never invoked from here, so that the caller can do so after releasing the lock.
+ *
+ * @return 0 if the lookup was queued, 1 if it was answered, or -1 if it was rejected; the answer
+ *  is filled in for the last two
+ */
+static int lookup_locked(struct ub4j_context* ctx, const struct ub4j_addr_key* key, uint64_t now_ms, void* userdata,
+                         ub4j_callback_type callback, struct ub4j_immediate_answer* answer) {
+    answer->userdata = userdata;
+    answer->status = UB4J_STATUS_OK;
+    answer->hostname = NULL;
+
+    if (ctx->overrides != NULL) {
+        const char* hostname = ub4j_overrides_find(ctx->overrides, key);
+        if (hostname != NULL) {
+            count(ctx, lookups);
+            count(ctx, override_hits);
+            // Copy the hostname, the overrides may be swapped out once the lock is released
+            snprintf(answer->hostname_buf, sizeof(answer->hostname_buf), "%s", hostname);
+            answer->hostname = answer->hostname_buf;
+            return 1;
+        }
+    }
+
+    const struct ub4j_rule_entry* rule = ctx->rules_enabled ? ub4j_rule_table_find(&ctx->rules, key) : NULL;
+    if (rule == NULL || rule->action == UB4J_RULE_RESOLVE) {
+        return resolve_locked(ctx, key, now_ms, userdata, callback, answer);
+    }
+
+    count(ctx, lookups);
+    count(ctx, short_circuited);
+    if (rule->action == UB4J_RULE_ANSWER_EMPTY) {
+        return 1;
+    }
+
+    // Routed lookups are resolved, and counted, by the target context. Its own rules don't apply.
+    int target_id = rule->ctx_id;
+    struct ub4j_context* target = NULL;
+    HASH_FIND_INT(g_contexts, &target_id, target);
+    if (target == NULL) {
+        answer->status = UB4J_STATUS_INVALID_CONTEXT;
+        return 1;
+    }
+    return resolve_locked(target, key, now_ms, userdata, callback, answer);
+}
+
+enum ub4j_status ub4j_reverse_lookup(int ctx_id, uint8_t* addr, size_t addr_len, void* userdata, ub4j_callback_type callback, char* error, size_t error_len) {
+    struct ub4j_addr_key key;
+    if (ub4j_addr_key_init(&key, addr, addr_len)) {
+        snprintf(error, error_len, "Invalid IP address length: %zu", addr_len);
+        return UB4J_STATUS_INVALID_ADDRESS;
+    }
+
+    // Acquire a read lock, and hold it until the lookup is queued so that the context
+    // can't be deleted from under us
     if (pthread_rwlock_rdlock(&g_ctx_lock) != 0) {
         snprintf(error, error_len, "Failed to acquire read lock.");
-        return -1;
+        return UB4J_STATUS_INTERNAL_ERROR;
     }
 
     // Lookup the context by id
     int id = (int)ctx_id;
     struct ub4j_context *ctx = NULL;
     HASH_FIND_INT(g_contexts, &id, ctx);
-
-    // Release the read lock
-    pthread_rwlock_unlock(&g_ctx_lock);
     if (ctx == NULL) {
+        pthread_rwlock_unlock(&g_ctx_lock);
         snprintf(error, error_len, "Invalid context id.");
-        return -1;
+        return UB4J_STATUS_INVALID_CONTEXT;
     }
 
-    // Convert the IP address to a name used for reverse lookups i.e.:
-    //  192.0.2.5 -> 5.2.0.192.in-addr.arpa.
-    //  2001:db8::567:89ab -> b.a.9.8.7.6.5.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa.
-    char* reverse_lookup_domain;
-    if (addr_len == 4) {
-        build_reverse_lookup_domain_v4((struct in_addr*)addr, &reverse_lookup_domain);
-    } else if (addr_len == 16) {
-        build_reverse_lookup_domain_v6((struct in6_addr*)addr, &reverse_lookup_domain);
-    } else {
-        snprintf(error, error_len, "Invalid IP address length: %zu", addr_len);
-        return -1;
+    struct ub4j_immediate_answer answer;
+    int nret = lookup_locked(ctx, &key, ub4j_monotonic_ms(), userdata, callback, &answer);
+    if (nret < 0) {
+        snprintf(error, error_len, "Too many outstanding queries on context.");
     }
 
-    if (reverse_lookup_domain == NULL) {
-        snprintf(error, error_len, "Failed to allocate memory for reverse lookup domain.");
-        return -1;
-    }
+    // Release the lock
+    pthread_rwlock_unlock(&g_ctx_lock);
 
-    struct ub4j_query* query = malloc(sizeof(struct ub4j_query));
-    if (query == NULL) {
-        snprintf(error, error_len, "Failed to allocate memory for query context.");
-        free(reverse_lookup_domain);
-        return -1;
+    if (nret > 0) {
+        // Answered from the cache, call back directly on the calling thread
+        callback(answer.userdata, answer.status, answer.hostname);
     }
+    return nret < 0 ? answer.status : UB4J_STATUS_OK;
+}
 
-    memset(query, 0, sizeof(struct ub4j_query));
-    query->userdata = userdata;
-    query->callback = callback;
+// Number of immediate answers we buffer before releasing the lock to call back
+#define BATCH_MAX_IMMEDIATE_ANSWERS 16
+
+enum ub4j_status ub4j_reverse_lookup_batch(int ctx_id, const uint8_t* addrs, size_t addrs_len, void** userdata, size_t addr_count,
+                                           ub4j_callback_type callback, char* error, size_t error_len) {
+    struct ub4j_immediate_answer answers[BATCH_MAX_IMMEDIATE_ANSWERS];
+    enum ub4j_status status = UB4J_STATUS_OK;
+    size_t offset = 0;
+    size_t i = 0;
+
+    while (i < addr_count) {
+        // Acquire a read lock, only giving it up when we need to call back
+        if (pthread_rwlock_rdlock(&g_ctx_lock) != 0) {
+            snprintf(error, error_len, "Failed to acquire read lock.");
+            status = UB4J_STATUS_INTERNAL_ERROR;
+            break;
+        }
 
-    // Grab a write lock for the query tracking *before* we actually make the call
-    if (pthread_rwlock_wrlock(&g_query_lock) != 0) {
-        snprintf(error, error_len, "Failed to acquire write lock.");
-        return -1;
+        int id = (int)ctx_id;
+        struct ub4j_context *ctx = NULL;
+        HASH_FIND_INT(g_contexts, &id, ctx);
+        if (ctx == NULL) {
+            pthread_rwlock_unlock(&g_ctx_lock);
+            snprintf(error, error_len, "Invalid context id.");
+            status = UB4J_STATUS_INVALID_CONTEXT;
+            break;
+        }
+
+        int num_answers = 0;
+        uint64_t now_ms = ub4j_monotonic_ms();
+        for (; i < addr_count && num_answers < BATCH_MAX_IMMEDIATE_ANSWERS; i++) {
+            struct ub4j_immediate_answer* answer = &answers[num_answers];
+
+            // Each address is preceded by its length
+            struct ub4j_addr_key key;
+            size_t addr_len = offset < addrs_len ? addrs[offset] : 0;
+            size_t next_offset = offset + 1 + addr_len;
+            if (next_offset > addrs_len || ub4j_addr_key_init(&key, addrs + offset + 1, addr_len)) {
+                answer->userdata = userdata[i];
+                answer->status = UB4J_STATUS_INVALID_ADDRESS;
+                answer->hostname = NULL;
+                num_answers++;
+            } else if (lookup_locked(ctx, &key, now_ms, userdata[i], callback, answer) != 0) {
+                num_answers++;
+            }
+            offset = next_offset;
+        }
+
+        pthread_rwlock_unlock(&g_ctx_lock);
+
+        for (int j = 0; j < num_answers; j++) {
+            callback(answers[j].userdata, answers[j].status, answers[j].hostname);
+        }
     }
 
-    // Set the expiry time
-    struct timeval tv_now;
-    gettimeofday(&tv_now, NULL);
-    query->expires_at_epoch_sec = tv_now.tv_sec + ctx->request_timeout_secs;
+    if (i == 0 && addr_count > 0) {
+        // Nothing was done
+        return status;
+    }
 
-    // Issue the reverse lookup
-    int nret = ub_resolve_async(ctx->ub_ctx, reverse_lookup_domain,
-                              12 /* RR_TYPE_PTR */,
-                              1 /* CLASS IN (internet) */,
-                              query,
-                              ub_reverse_lookup_callback,
-                              &query->id);
+    // The context went away midway, fail the remaining lookups
+    for (; i < addr_count; i++) {
+        callback(userdata[i], status, NULL);
+    }
+    return UB4J_STATUS_OK;
+}
 
-    // We're done with the domain name now
-    free(reverse_lookup_domain);
+/**
+ * Submits a probe queued by probe_delegation(), unless the same prefix is already being probed.
+ */
+static void submit_probe(struct ub4j_shard *shard, struct ub4j_query* probe) {
+    if (shard->probes.count >= UB4J_MAX_PROBES || ub4j_pending_get(&shard->probes, &probe->key) != NULL) {
+        release_query(shard, probe);
+        return;
+    }
 
-    if (nret) {
-        // The async query failed to be submitted, free the query context
-        free(query);
-        snprintf(error, error_len, "Resolve error: %s", ub_strerror(nret));
+    // Query the name of the reverse zone for the prefix i.e.:
+    //  192.0.2.0/24 -> 2.0.192.in-addr.arpa.
+    //  2001:db8::/48 -> 0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa.
+    uint8_t addr[16];
+    char reverse_lookup_domain[REVERSE_LOOKUP_DOMAIN_MAX_LEN];
+    const char* prefix_domain;
+    if (ub4j_addr_key_to_bytes(&probe->key, addr) == 4) {
+        build_reverse_lookup_domain_v4((struct in_addr*)addr, reverse_lookup_domain, sizeof(reverse_lookup_domain));
+        prefix_domain = strchr(reverse_lookup_domain, '.') + 1;
     } else {
-        // The async query was successfully submitted, let's track it
-        HASH_ADD_INT(g_queries, id, query);
+        build_reverse_lookup_domain_v6((struct in6_addr*)addr, reverse_lookup_domain, sizeof(reverse_lookup_domain));
+        prefix_domain = reverse_lookup_domain + 40; // skip the 20 nibbles after the /48
     }
 
-    // Release the write lock
-    pthread_rwlock_unlock(&g_query_lock);
+    if (ub_resolve_async(shard->ub_ctx, prefix_domain,
+                         12 /* RR_TYPE_PTR */,
+                         1 /* CLASS IN (internet) */,
+                         probe,
+                         ub_reverse_lookup_callback,
+                         &probe->id)) {
+        release_query(shard, probe);
+        return;
+    }
 
-    return nret;
+    count(shard->ctx, queries_sent);
+    ub4j_inflight_put(&shard->queries, probe->id, probe);
+    ub4j_pending_put(&shard->probes, &probe->key, probe);
+    ub4j_timer_add(&shard->timers, &probe->timer, probe->submitted_ms + shard->ctx->request_timeout_ms);
 }
 
-void* context_processing_thread(void *arg) {
-    struct ub4j_context *ctx = (struct ub4j_context *)arg;
-    struct ub4j_query *query, *query_tmp;
+/**
+ * Submits the lookups that were queued on the shard to Unbound, or attaches them to the query
+ * that's already in flight for the same address.
+ */
+static void submit_queued_queries(struct ub4j_shard *shard) {
+    struct ub4j_context *ctx = shard->ctx;
+    struct ub4j_mpsc_node *node = ub4j_mpsc_take_all(&shard->submissions);
 
-    struct timeval tv;
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(ctx->ub_fd, &rfds);
+    while (node != NULL) {
+        struct ub4j_query* query = query_from_node(node);
+        node = node->next;
 
-    while(!ctx->stopping) {
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
+        if (query->probe) {
+            submit_probe(shard, query);
+            continue;
+        }
 
-        int ret = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
-        if (ret >= 0) {
-            if(ub_process(ctx->ub_ctx)) {
-                log_fatal("unbound4j: ub_process() error!");
-            }
+        // If there's already a query in flight for this address, wait for its answer instead
+        struct ub4j_query* pending = ub4j_pending_get(&shard->queries_by_addr, &query->key);
+        if (pending != NULL) {
+            query->next = pending->waiters;
+            pending->waiters = query;
+            count(ctx, coalesced);
+            continue;
         }
 
-        // Get the current time
-        struct timeval tv_now;
-        gettimeofday(&tv_now, NULL);
+        // Convert the IP address to a name used for reverse lookups i.e.:
+        //  192.0.2.5 -> 5.2.0.192.in-addr.arpa.
+        //  2001:db8::567:89ab -> b.a.9.8.7.6.5.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa.
+        // IPv4-mapped IPv6 addresses are looked up as the IPv4 address they map to.
+        uint8_t addr[16];
+        char reverse_lookup_domain[REVERSE_LOOKUP_DOMAIN_MAX_LEN];
+        if (ub4j_addr_key_to_bytes(&query->key, addr) == 4) {
+            build_reverse_lookup_domain_v4((struct in_addr*)addr, reverse_lookup_domain, sizeof(reverse_lookup_domain));
+        } else {
+            build_reverse_lookup_domain_v6((struct in6_addr*)addr, reverse_lookup_domain, sizeof(reverse_lookup_domain));
+        }
 
-        // Acquire a read lock
-        if (pthread_rwlock_rdlock(&g_query_lock) != 0) {
-            log_fatal("unbound4j: Failed to acquire read lock.");
+        // Issue the reverse lookup
+        int nret = ub_resolve_async(shard->ub_ctx, reverse_lookup_domain,
+                                  12 /* RR_TYPE_PTR */,
+                                  1 /* CLASS IN (internet) */,
+                                  query,
+                                  ub_reverse_lookup_callback,
+                                  &query->id);
+
+        if (nret) {
+            // The async query failed to be submitted
+            if (query->refresh && ctx->cache_enabled) {
+                defer_refresh(ctx, query, ctx->cache_servfail_ttl_secs);
+            }
+            complete_query(query, UB4J_STATUS_RESOLVER_ERROR, NULL);
             continue;
         }
 
-        // Peek at the head of the list and determine whether or not we need to cancel any queries
-        unsigned char need_to_cancel_queries = 0;
-        query = g_queries;
-        if (query != NULL && query->expires_at_epoch_sec <= tv_now.tv_sec) {
-            need_to_cancel_queries = 1;
+        // The async query was successfully submitted, let's track it and schedule its expiry
+        count(ctx, queries_sent);
+        ub4j_inflight_put(&shard->queries, query->id, query);
+        ub4j_pending_put(&shard->queries_by_addr, &query->key, query);
+        ub4j_timer_add(&shard->timers, &query->timer, query->submitted_ms + ctx->request_timeout_ms);
+    }
+}
+
+static void expire_queries(struct ub4j_shard *shard, uint64_t now_ms) {
+    struct ub4j_timer* timer = ub4j_timer_wheel_advance(&shard->timers, now_ms);
+    while (timer != NULL) {
+        struct ub4j_query *query = query_from_timer(timer);
+        timer = timer->next;
+        // Stop tracking the query
+        ub4j_inflight_remove(&shard->queries, query->id);
+        ub4j_pending_remove(pending_table_for(shard, query), &query->key);
+        // Cancel the query, no callback will be made by libunbound
+        ub_cancel(shard->ub_ctx, query->id);
+        // Mark the query as expired, and issue the callback ourselves
+        query->expired = 1;
+        if (!query->probe) {
+            count(shard->ctx, timeouts);
         }
+        ub_reverse_lookup_callback(query, 1, NULL);
+    }
+}
 
-        // Release our read lock
-        pthread_rwlock_unlock(&g_query_lock);
+static void cancel_all_queries(struct ub4j_shard *shard) {
+    struct ub4j_query *query;
+
+    for (size_t i = 0; shard->queries.count > 0 && i <= shard->queries.mask; i++) {
+        // Entries may be shifted back into this slot as we remove them
+        while ((query = (struct ub4j_query*)ub4j_inflight_remove_at(&shard->queries, i)) != NULL) {
+            ub4j_pending_remove(pending_table_for(shard, query), &query->key);
+            ub4j_timer_remove(&shard->timers, &query->timer);
+            ub_cancel(shard->ub_ctx, query->id);
+            query->expired = 1;
+            ub_reverse_lookup_callback(query, 1, NULL);
+        }
+    }
 
-        if (need_to_cancel_queries) {
-            // Acquire a write lock
-            if (pthread_rwlock_wrlock(&g_query_lock) != 0) {
-                log_fatal("unbound4j: Failed to acquire write lock.");
-                continue;
-            }
+    // Fail any lookups that were queued but never submitted
+    struct ub4j_mpsc_node *node = ub4j_mpsc_take_all(&shard->submissions);
+    while (node != NULL) {
+        query = query_from_node(node);
+        node = node->next;
+        query->expired = 1;
+        ub_reverse_lookup_callback(query, 1, NULL);
+    }
+}
 
-            // Iterate through the outstanding queries
-            HASH_ITER(hh, g_queries, query, query_tmp) {
-                if (query->expires_at_epoch_sec <= tv_now.tv_sec) {
-                    // Remove the item from the hash
-                    HASH_DEL(g_queries, query);
-                    // Cancel the query, no callback will be made by libunbound
-                    ub_cancel(ctx->ub_ctx, query->id);
-                    // Mark the query as expired
-                    query->expired = 1;
-                    // Issue the callback ourselves
-                    ub_reverse_lookup_callback(query, 1, NULL);
-                } else {
-                    break;
-                }
-            }
+/**
+ * @return 1 if this shard's thread ages the admission filter of the context, see ub4j_admission_age()
+ */
+static inline int ages_admission(struct ub4j_shard *shard) {
+    return shard->index == 0 && shard->ctx->admission_enabled;
+}
 
-            // Release our write lock
-            pthread_rwlock_unlock(&g_query_lock);
+/**
+ * Determines how long we can wait for answers or new lookups before we need to check for expired queries.
+ */
+static int next_poll_timeout_ms(struct ub4j_shard *shard, uint64_t now_ms) {
+    uint64_t deadline_ms;
+    int no_timers = ub4j_timer_wheel_next_deadline(&shard->timers, &deadline_ms);
+    if (ages_admission(shard)) {
+        // Lookups that aren't admitted never wake us up, so don't rely on them to
+        uint64_t age_ms = ub4j_admission_next_age_ms(&shard->ctx->admission);
+        if (no_timers || age_ms < deadline_ms) {
+            deadline_ms = age_ms;
         }
+        no_timers = 0;
+    }
+    if (no_timers) {
+        // Nothing to expire, sleep until there are answers or we're woken up
+        return -1;
+    } else if (deadline_ms <= now_ms) {
+        return 0;
+    } else if (deadline_ms - now_ms < INT_MAX) {
+        return (int)(deadline_ms - now_ms);
     }
+    return INT_MAX;
+}
 
-    // We're stopping - clean up the outstanding queries
+void* shard_processing_thread(void *arg) {
+    struct ub4j_shard *shard = (struct ub4j_shard *)arg;
+    struct ub4j_context *ctx = shard->ctx;
 
-    // Acquire a write lock
-    if (pthread_rwlock_wrlock(&g_query_lock) != 0) {
-        log_fatal("unbound4j: Failed to acquire write lock.");
+    if (g_thread_start_hook != NULL) {
+        g_thread_start_hook(shard);
     }
 
-    // Iterate through the outstanding queries
-    HASH_ITER(hh, g_queries, query, query_tmp) {
-        // Remove the item from the hash
-        HASH_DEL(g_queries, query);
-        // Cancel the query, no callback will be made by libunbound
-        ub_cancel(ctx->ub_ctx, query->id);
-        // Mark the query as expired
-        query->expired = 1;
-        // Issue the callback ourselves
-        ub_reverse_lookup_callback(query, 1, NULL);
+    while(!ctx->stopping) {
+        int timeout_ms = next_poll_timeout_ms(shard, ub4j_monotonic_ms());
+
+        int events = ub4j_evloop_wait(&shard->evloop, timeout_ms);
+        if (events < 0) {
+            log_fatal("unbound4j: Waiting for events failed!");
+        } else if (events & UB4J_EV_READABLE) {
+            if(ub_process(shard->ub_ctx)) {
+                log_fatal("unbound4j: ub_process() error!");
+            }
+        }
+
+        // Submit the lookups that were queued while we were waiting
+        submit_queued_queries(shard);
+
+        // Cancel any of our queries that have expired
+        expire_queries(shard, ub4j_monotonic_ms());
+
+        if (ages_admission(shard)) {
+            ub4j_admission_age(&shard->ctx->admission, ub4j_monotonic_ms());
+        }
     }
 
-    // Release our write lock
-    pthread_rwlock_unlock(&g_query_lock);
+    // We're stopping - clean up the outstanding queries
+    cancel_all_queries(shard);
 
+    if (g_thread_stop_hook != NULL) {
+        g_thread_stop_hook(shard);
+    }
     return NULL;
 }
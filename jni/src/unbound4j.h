@@ -17,28 +17,184 @@
 #ifndef UNBOUND4J_UNBOUND4J_H
 #define UNBOUND4J_UNBOUND4J_H
 
+#include <stdatomic.h>
+#include <stdint.h>
+
 #include "uthash.h"
+#include "inflight.h"
+#include "timerwheel.h"
+#include "evloop.h"
+#include "addrkey.h"
+#include "cache.h"
+#include "mpsc.h"
+#include "slab.h"
+#include "ruletable.h"
+#include "overrides.h"
+#include "shmcache.h"
+#include "admission.h"
 
 struct ub4j_config {
     short use_system_resolver;
     const char* unbound_config;
-    int request_timeout_secs;
+    int request_timeout_ms;
+    int max_inflight_queries;
+    int shards;
+    int cache_capacity; // 0 disables the cache
+    int cache_max_ttl_secs;
+    int cache_nxdomain_ttl_secs; // 0 disables caching of the outcome, as for the two below
+    int cache_servfail_ttl_secs;
+    int cache_timeout_ttl_secs;
+    int cache_refresh_percent; // of the TTL after which hot entries are resolved again in the background, 0 disables
+    int cache_refresh_min_hits; // hits an entry needs before it's considered hot
+    int cache_refresh_max_per_sec; // budget for the background refreshes
+    int cache_max_stale_secs; // how long past their expiry entries are served stale, 0 disables
+    int negative_prefix_cache_capacity; // 0 disables the cache of reverse zones that don't exist
+    short special_purpose_rules; // answer the special-purpose ranges of RFC 6890 empty, see ruletable.c
+    const struct ub4j_prefix_rule* prefix_rules; // take precedence over the special-purpose ranges
+    size_t prefix_rule_count;
+    const char* overrides_file; // generated by unbound4j_hostsgen, or NULL for none
+    const char* cache_snapshot_file; // loaded on creation and written on deletion, or NULL for none
+    int cache_snapshot_interval_secs; // 0 only writes the snapshot on deletion
+    const char* shared_cache_name; // shared memory segment holding a cache used by all processes, or NULL for none
+    int shared_cache_capacity; // only used by the process that creates the segment
+    int admission_min_hits; // lookups an address needs within the window before it's resolved, 0 disables
+    int admission_window_secs;
+    int admission_sketch_width; // counters in each row of the sketch, see admission.h
+    int64_t memory_budget_bytes; // bounds the memory reported by ub4j_get_stats(), 0 for no bound
 };
 
-struct ub4j_context {
-    int id;
+struct ub4j_context;
+
+/*
+ * A shard wraps one Unbound context, along with the thread that processes its answers.
+ * Every address is always resolved by the same shard so that its entry stays in a single cache.
+ *
+ * Callers only ever push lookups onto the submission queue. Everything else, from submitting
+ * the queries to Unbound to tracking and expiring them, is done by the processing thread,
+ * so the query tables and timers need no locking.
+ */
+struct ub4j_shard {
+    struct ub4j_context* ctx;
+    int index;
     struct ub_ctx *ub_ctx;
     int ub_fd;
     pthread_t thread_id;
+    short thread_started;
+    struct ub4j_evloop evloop;
+    struct ub4j_mpsc_queue submissions;
+    atomic_int outstanding; // lookups submitted to the shard that haven't completed yet
+    int max_outstanding;
+    struct ub4j_slab query_records; // one for each of the outstanding lookups
+    struct ub4j_inflight_table queries;
+    struct ub4j_pending_table queries_by_addr; // used to coalesce lookups for the same address
+    struct ub4j_pending_table probes; // probes in flight, by prefix, when the negative prefix cache is enabled
+    struct ub4j_timer_wheel timers;
+};
+
+/*
+ * Counters for the lookups made against a context, see ub4j_get_stats().
+ */
+struct ub4j_stats {
+    uint64_t lookups;       // calls to ub4j_reverse_lookup() with a valid address
+    uint64_t cache_hits;    // lookups answered from the cache
+    uint64_t coalesced;     // lookups attached to a query already in flight for the same address
+    uint64_t queries_sent;  // queries submitted to Unbound
+    uint64_t rejected;      // lookups rejected because too many queries were in flight
+    uint64_t timeouts;      // queries that timed out
+    uint64_t short_circuited; // lookups answered empty, or routed to another context, by a prefix rule
+    uint64_t override_hits; // lookups answered from the overrides file
+    uint64_t shared_cache_hits; // lookups answered from the shared cache
+    uint64_t refreshes;     // queries made to refresh hot cache entries ahead of their expiry
+    uint64_t stale_hits;    // cache hits answered with an expired entry, included in cache_hits
+    uint64_t not_admitted;  // lookups left unresolved by the admission filter
+    uint64_t hostname_allocations; // cached hostnames copied to the heap, the only allocations made while handling lookups
+    // Memory held by the context, see memory_budget_bytes. All of it but the hostnames is allocated up front.
+    uint64_t inflight_bytes; // tracking of the in-flight queries
+    uint64_t cache_bytes;    // entries of the cache
+    uint64_t hostname_bytes; // cached hostnames too long to be stored in their entry
+    uint64_t other_bytes;    // negative prefix cache and admission filter
+};
+
+struct ub4j_context_counters {
+    atomic_ullong lookups;
+    atomic_ullong cache_hits;
+    atomic_ullong coalesced;
+    atomic_ullong queries_sent;
+    atomic_ullong rejected;
+    atomic_ullong timeouts;
+    atomic_ullong short_circuited;
+    atomic_ullong override_hits;
+    atomic_ullong shared_cache_hits;
+    atomic_ullong refreshes;
+    atomic_ullong stale_hits;
+    atomic_ullong not_admitted;
+};
+
+struct ub4j_context {
+    int id;
     volatile short stopping;
-    int request_timeout_secs;
+    int request_timeout_ms;
+    int shard_count;
+    struct ub4j_shard* shards;
+    short cache_enabled;
+    struct ub4j_cache cache; // shared by all of the shards
+    uint32_t cache_nxdomain_ttl_secs;
+    uint32_t cache_servfail_ttl_secs;
+    uint32_t cache_timeout_ttl_secs;
+    int cache_refresh_max_per_sec;
+    atomic_ullong refresh_window; // second in the upper 32 bits, refreshes made during it in the lower ones
+    short prefix_cache_enabled;
+    struct ub4j_cache prefix_cache; // prefixes whose reverse zone doesn't exist, see probe_delegation()
+    short rules_enabled;
+    struct ub4j_rule_table rules;
+    struct ub4j_overrides* overrides; // swapped with the write lock held, see ub4j_set_overrides()
+    struct ub4j_shm_cache* shared_cache; // NULL unless enabled
+    short admission_enabled;
+    struct ub4j_admission admission;
+    char* cache_snapshot_file; // only set when the cache is enabled
+    int cache_snapshot_interval_secs;
+    short snapshot_thread_started;
+    short snapshot_stopping;
+    pthread_t snapshot_thread_id;
+    pthread_mutex_t snapshot_lock;
+    pthread_cond_t snapshot_stop; // signalled to stop the snapshot thread, see stop_snapshot_thread()
+    struct ub4j_context_counters counters;
     UT_hash_handle hh; // makes this structure hashable
 };
 
-typedef void (*ub4j_callback_type)(void*, const char*, char*);
+/*
+ * Outcome of a lookup. Keep in sync with org.opennms.unbound4j.impl.PendingLookups.
+ */
+enum ub4j_status {
+    UB4J_STATUS_OK = 0,
+    UB4J_STATUS_TIMEOUT,
+    UB4J_STATUS_REJECTED, // too many outstanding queries
+    UB4J_STATUS_INVALID_ADDRESS,
+    UB4J_STATUS_INVALID_CONTEXT,
+    UB4J_STATUS_RESOLVER_ERROR, // libunbound failed to resolve the query
+    UB4J_STATUS_INTERNAL_ERROR,
+    UB4J_STATUS_STALE, // answered from an expired cache entry, while it's being resolved again
+    UB4J_STATUS_NOT_ADMITTED // not resolved, the address hasn't been seen often enough yet
+};
+
+/**
+ * Called with the userdata, the status of the lookup, and the hostname or NULL if there is none.
+ * The hostname is only valid for the duration of the call, and must be copied if needed afterwards.
+ */
+typedef void (*ub4j_callback_type)(void*, enum ub4j_status, const char*);
+
+/**
+ * Called on the shard's processing thread right after it starts, and right before it exits.
+ */
+typedef void (*ub4j_thread_hook_type)(const struct ub4j_shard*);
 
 void ub4j_init();
 
+/**
+ * Sets the hooks invoked by the processing threads. Must be called before any context is created.
+ */
+void ub4j_set_thread_hooks(ub4j_thread_hook_type on_start, ub4j_thread_hook_type on_stop);
+
 void ub4j_destroy();
 
 void ub4j_config_init(struct ub4j_config* config);
@@ -47,6 +203,39 @@ struct ub4j_context* ub4j_create_context(struct ub4j_config* config, char* error
 
 int ub4j_delete_context(int ctx_id, char* error, size_t error_len);
 
-int ub4j_reverse_lookup(int ctx_id, uint8_t* addr, size_t addr_len, void* mydata, ub4j_callback_type callback, char* error, size_t error_len);
+int ub4j_get_stats(int ctx_id, struct ub4j_stats* stats, char* error, size_t error_len);
+
+/**
+ * Replaces the overrides of the context with those of the given file, or removes them if path is NULL.
+ * Lookups see either the old or the new overrides, never a mix of both.
+ */
+int ub4j_set_overrides(int ctx_id, const char* path, char* error, size_t error_len);
+
+/**
+ * @return a static description of the status
+ */
+const char* ub4j_strerror(enum ub4j_status status);
+
+/**
+ * Looks up the address, the callback is invoked once the lookup completes. This may happen on the calling
+ * thread, before the call returns, when the answer is cached.
+ *
+ * @return UB4J_STATUS_OK if the lookup was made, otherwise the reason it wasn't, with the error filled in,
+ *  in which case the callback is not invoked
+ */
+enum ub4j_status ub4j_reverse_lookup(int ctx_id, uint8_t* addr, size_t addr_len, void* mydata, ub4j_callback_type callback, char* error, size_t error_len);
+
+/**
+ * Looks up several addresses at once, taking the context lock once rather than once per address.
+ *
+ * The addresses are packed one after the other, each preceded by a byte giving its length (4 or 16).
+ * The callback is invoked once for each of the addr_count addresses, with the matching entry of userdata.
+ * Invalid addresses, and lookups that are rejected, are reported through the callback.
+ *
+ * @return UB4J_STATUS_OK on success, otherwise the reason none of the lookups could be made (i.e. the context
+ *  doesn't exist), in which case the callback is not invoked
+ */
+enum ub4j_status ub4j_reverse_lookup_batch(int ctx_id, const uint8_t* addrs, size_t addrs_len, void** userdata, size_t addr_count,
+                              ub4j_callback_type callback, char* error, size_t error_len);
 
 #endif //UNBOUND4J_UNBOUND4J_H
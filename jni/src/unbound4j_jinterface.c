@@ -53,24 +53,52 @@
 
 #include <unbound.h>
 
+#include "completionring.h"
 #include "jniutils.h"
 #include "unbound4j.h"
 #include "log.h"
 
 struct ub4j_java_refs {
-    jclass completableFuture;
-    jmethodID completableFuture_complete;
-    jmethodID completableFuture_constructor;
+    jclass interface;
+    jmethodID interface_complete;
+    jmethodID interface_failure;
 };
 
 struct ub4j_java_refs g_java_refs;
 
-struct ub4j_java_callback_context {
-    jobject future;
-};
-
 JavaVM* g_vm;
 
+// Ring shared with org.opennms.unbound4j.impl.CompletionRing, created on first use
+struct ub4j_completion_ring g_ring;
+int g_ring_created = 0;
+pthread_mutex_t g_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Attaches the processing thread to the VM for the lifetime of the context, so that completing
+ * lookups doesn't require attaching and detaching the thread every time.
+ */
+static void attach_processing_thread(const struct ub4j_shard* shard) {
+    char name[64];
+    if (shard->ctx->shard_count > 1) {
+        snprintf(name, sizeof(name), "unbound4j-ctx-%d-%d", shard->ctx->id, shard->index);
+    } else {
+        snprintf(name, sizeof(name), "unbound4j-ctx-%d", shard->ctx->id);
+    }
+
+    JNIEnv *env;
+    JavaVMAttachArgs args;
+    args.version = JNI_VERSION_1_8;
+    args.name = name;
+    args.group = NULL;
+    if ((*g_vm)->AttachCurrentThreadAsDaemon(g_vm, (void **)&env, &args) != JNI_OK) {
+        log_error("unbound4j: Failed to attach processing thread %s to VM.", name);
+    }
+}
+
+static void detach_processing_thread(const struct ub4j_shard* shard) {
+    (*g_vm)->DetachCurrentThread(g_vm);
+}
+
 jint JNI_OnLoad(JavaVM* vm, void* reserved) {
     printf("unbound4j: Loaded with libunbound v%s\n", ub_version());
     fflush(stdout);
@@ -84,32 +112,35 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved) {
     memset(&g_java_refs, 0, sizeof(struct ub4j_java_refs));
     // Lookups classes/methods that we know we'll need and convert these to global refs so that they will remain
     // accessible by other threads
-    g_java_refs.completableFuture = (*env)->FindClass(env, "java/util/concurrent/CompletableFuture");
-    if (g_java_refs.completableFuture == NULL) {
-        log_fatal("unbound4j: Failed to find class for CompletableFuture.");
+    g_java_refs.interface = (*env)->FindClass(env, "org/opennms/unbound4j/impl/Interface");
+    if (g_java_refs.interface == NULL) {
+        log_fatal("unbound4j: Failed to find class for Interface.");
         fflush(stdout);
         return JNI_ERR;
     }
-    g_java_refs.completableFuture = (*env)->NewGlobalRef(env, g_java_refs.completableFuture);
-    if (g_java_refs.completableFuture == NULL) {
-        log_fatal("unbound4j: Failed to convert CompletableFuture class to global reference.");
+    g_java_refs.interface = (*env)->NewGlobalRef(env, g_java_refs.interface);
+    if (g_java_refs.interface == NULL) {
+        log_fatal("unbound4j: Failed to convert Interface class to global reference.");
         fflush(stdout);
         return JNI_ERR;
     }
-    g_java_refs.completableFuture_constructor = (*env)->GetMethodID(env, g_java_refs.completableFuture, "<init>", "()V");
-    if (g_java_refs.completableFuture_constructor == NULL) {
-        log_fatal("unbound4j: Failed to find constructor on CompletableFuture.");
+    // static void complete(long id, int status, String hostname);
+    g_java_refs.interface_complete = (*env)->GetStaticMethodID(env, g_java_refs.interface, "complete", "(JILjava/lang/String;)V");
+    if (g_java_refs.interface_complete == NULL) {
+        log_fatal("unbound4j: Failed to find complete method on Interface.");
         fflush(stdout);
         return JNI_ERR;
     }
-    g_java_refs.completableFuture_complete = (*env)->GetMethodID(env, g_java_refs.completableFuture, "complete", "(Ljava/lang/Object;)Z");
-    if (g_java_refs.completableFuture_complete == NULL) {
-        log_fatal("unbound4j: Failed to find complete method on CompletableFuture.");
+    // static LookupFailedException failure(int status);
+    g_java_refs.interface_failure = (*env)->GetStaticMethodID(env, g_java_refs.interface, "failure", "(I)Lorg/opennms/unbound4j/api/LookupFailedException;");
+    if (g_java_refs.interface_failure == NULL) {
+        log_fatal("unbound4j: Failed to find failure method on Interface.");
         fflush(stdout);
         return JNI_ERR;
     }
 
     ub4j_init();
+    ub4j_set_thread_hooks(attach_processing_thread, detach_processing_thread);
 
     return JNI_VERSION_1_8;
 }
@@ -119,15 +150,53 @@ void JNI_OnUnload(JavaVM* vm, void* reserved) {
     fflush(stdout);
 
     ub4j_destroy();
+
+    pthread_mutex_lock(&g_ring_lock);
+    if (g_ring_created) {
+        ub4j_ring_free(&g_ring);
+        g_ring_created = 0;
+    }
+    pthread_mutex_unlock(&g_ring_lock);
 }
 
 JNIEXPORT jstring JNICALL Java_org_opennms_unbound4j_impl_Interface_version(JNIEnv *env, jclass clazz) {
     return (*env)->NewStringUTF(env, ub_version());
 }
 
-JNIEXPORT jint JNICALL Java_org_opennms_unbound4j_impl_Interface_create_1context(JNIEnv *env, jclass clazz, jobject config) {
+/**
+ * Unpacks the prefix rules, each made up of the action, the length of the address followed by the address,
+ * the prefix length and the id of the context, as written by org.opennms.unbound4j.impl.Interface#packPrefixRules.
+ *
+ * @return the number of rules, or -1 if they are malformed
+ */
+static int unpack_prefix_rules(const uint8_t* packed, size_t packed_len, struct ub4j_prefix_rule* rules, size_t max_rules) {
+    size_t offset = 0;
+    size_t count = 0;
+    while (offset < packed_len) {
+        if (count >= max_rules || offset + 2 > packed_len) {
+            return -1;
+        }
+        struct ub4j_prefix_rule* rule = &rules[count++];
+        rule->action = (enum ub4j_rule_action)packed[offset];
+        rule->addr_len = packed[offset + 1];
+        offset += 2;
+        if (rule->addr_len > (int)sizeof(rule->addr) || offset + (size_t)rule->addr_len + 5 > packed_len) {
+            return -1;
+        }
+        memcpy(rule->addr, packed + offset, (size_t)rule->addr_len);
+        offset += (size_t)rule->addr_len;
+        rule->prefix_len = packed[offset];
+        rule->ctx_id = (int)(((uint32_t)packed[offset + 1] << 24) | ((uint32_t)packed[offset + 2] << 16) |
+                             ((uint32_t)packed[offset + 3] << 8) | (uint32_t)packed[offset + 4]);
+        offset += 5;
+    }
+    return (int)count;
+}
+
+JNIEXPORT jint JNICALL Java_org_opennms_unbound4j_impl_Interface_create_1context(JNIEnv *env, jclass clazz, jobject config, jbyteArray prefix_rules) {
     // Map the configuration from the POJO to the C struct
     struct ub4j_config ub4jconf;
+    ub4j_config_init(&ub4jconf);
 
     char *unbound4jConfigClassName = "org/opennms/unbound4j/api/Unbound4jConfig";
     jclass unbound4jConfigClazz = (*env)->FindClass(env, unbound4jConfigClassName);
@@ -153,14 +222,6 @@ JNIEXPORT jint JNICALL Java_org_opennms_unbound4j_impl_Interface_create_1context
         return -1;
     }
 
-    //  public int getRequestTimeoutSeconds();
-    //    descriptor: ()I
-    jmethodID getRequestTimeoutSecondsMethod = (*env)->GetMethodID(env, unbound4jConfigClazz, "getRequestTimeoutSeconds", "()I");
-    if (getRequestTimeoutSecondsMethod == NULL) {
-        throwRuntimeException(env, "getRequestTimeoutSeconds method not found.");
-        return -1;
-    }
-
     ub4jconf.use_system_resolver = (*env)->CallBooleanMethod(env, config, isUseSystemResolverMethod);
     jobject unboundConfig = (*env)->CallObjectMethod(env, config, getUnboundConfigMethod);
     const char *unboundConfigStr = NULL;
@@ -168,22 +229,154 @@ JNIEXPORT jint JNICALL Java_org_opennms_unbound4j_impl_Interface_create_1context
         unboundConfigStr = (*env)->GetStringUTFChars(env, unboundConfig, NULL);
     }
     ub4jconf.unbound_config = unboundConfigStr;
-    ub4jconf.request_timeout_secs = (*env)->CallIntMethod(env, config, getRequestTimeoutSecondsMethod);
+
+    // public java.lang.String getOverridesFile();
+    //    descriptor: ()Ljava/lang/String;
+    jmethodID getOverridesFileMethod = (*env)->GetMethodID(env, unbound4jConfigClazz, "getOverridesFile", "()Ljava/lang/String;");
+    if (getOverridesFileMethod == NULL) {
+        if (unboundConfigStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, unboundConfig, unboundConfigStr);
+        }
+        throwRuntimeException(env, "getOverridesFile method not found.");
+        return -1;
+    }
+    jobject overridesFile = (*env)->CallObjectMethod(env, config, getOverridesFileMethod);
+    const char *overridesFileStr = NULL;
+    if (overridesFile != NULL) {
+        overridesFileStr = (*env)->GetStringUTFChars(env, overridesFile, NULL);
+    }
+    ub4jconf.overrides_file = overridesFileStr;
+
+    // public java.lang.String getCacheSnapshotFile();
+    //    descriptor: ()Ljava/lang/String;
+    jmethodID getCacheSnapshotFileMethod = (*env)->GetMethodID(env, unbound4jConfigClazz, "getCacheSnapshotFile", "()Ljava/lang/String;");
+    if (getCacheSnapshotFileMethod == NULL) {
+        if (unboundConfigStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, unboundConfig, unboundConfigStr);
+        }
+        if (overridesFileStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, overridesFile, overridesFileStr);
+        }
+        throwRuntimeException(env, "getCacheSnapshotFile method not found.");
+        return -1;
+    }
+    jobject cacheSnapshotFile = (*env)->CallObjectMethod(env, config, getCacheSnapshotFileMethod);
+    const char *cacheSnapshotFileStr = NULL;
+    if (cacheSnapshotFile != NULL) {
+        cacheSnapshotFileStr = (*env)->GetStringUTFChars(env, cacheSnapshotFile, NULL);
+    }
+    ub4jconf.cache_snapshot_file = cacheSnapshotFileStr;
+
+    // public java.lang.String getSharedCacheName();
+    //    descriptor: ()Ljava/lang/String;
+    jmethodID getSharedCacheNameMethod = (*env)->GetMethodID(env, unbound4jConfigClazz, "getSharedCacheName", "()Ljava/lang/String;");
+    if (getSharedCacheNameMethod == NULL) {
+        if (unboundConfigStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, unboundConfig, unboundConfigStr);
+        }
+        if (overridesFileStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, overridesFile, overridesFileStr);
+        }
+        if (cacheSnapshotFileStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, cacheSnapshotFile, cacheSnapshotFileStr);
+        }
+        throwRuntimeException(env, "getSharedCacheName method not found.");
+        return -1;
+    }
+    jobject sharedCacheName = (*env)->CallObjectMethod(env, config, getSharedCacheNameMethod);
+    const char *sharedCacheNameStr = NULL;
+    if (sharedCacheName != NULL) {
+        sharedCacheNameStr = (*env)->GetStringUTFChars(env, sharedCacheName, NULL);
+    }
+    ub4jconf.shared_cache_name = sharedCacheNameStr;
+
+    // The remaining settings are all ints, i.e.:
+    //  public int getRequestTimeoutMillis();
+    //    descriptor: ()I
+    if (call_int_getter(env, config, unbound4jConfigClazz, "getRequestTimeoutMillis", &ub4jconf.request_timeout_ms) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getMaxInflightQueries", &ub4jconf.max_inflight_queries) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getShards", &ub4jconf.shards) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheCapacity", &ub4jconf.cache_capacity) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheMaxTtlSeconds", &ub4jconf.cache_max_ttl_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheNxdomainTtlSeconds", &ub4jconf.cache_nxdomain_ttl_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheServfailTtlSeconds", &ub4jconf.cache_servfail_ttl_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheTimeoutTtlSeconds", &ub4jconf.cache_timeout_ttl_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheRefreshPercent", &ub4jconf.cache_refresh_percent) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheRefreshMinHits", &ub4jconf.cache_refresh_min_hits) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheRefreshMaxPerSecond", &ub4jconf.cache_refresh_max_per_sec) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheMaxStaleSeconds", &ub4jconf.cache_max_stale_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getNegativePrefixCacheCapacity", &ub4jconf.negative_prefix_cache_capacity) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getCacheSnapshotIntervalSeconds", &ub4jconf.cache_snapshot_interval_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getSharedCacheCapacity", &ub4jconf.shared_cache_capacity) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getAdmissionMinHits", &ub4jconf.admission_min_hits) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getAdmissionWindowSeconds", &ub4jconf.admission_window_secs) ||
+        call_int_getter(env, config, unbound4jConfigClazz, "getAdmissionSketchWidth", &ub4jconf.admission_sketch_width) ||
+        call_long_getter(env, config, unbound4jConfigClazz, "getMemoryBudgetBytes", &ub4jconf.memory_budget_bytes) ||
+        call_boolean_getter(env, config, unbound4jConfigClazz, "isUseSpecialPurposeRules", &ub4jconf.special_purpose_rules)) {
+        if (unboundConfigStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, unboundConfig, unboundConfigStr);
+        }
+        if (overridesFileStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, overridesFile, overridesFileStr);
+        }
+        if (cacheSnapshotFileStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, cacheSnapshotFile, cacheSnapshotFileStr);
+        }
+        if (sharedCacheNameStr != NULL) {
+            (*env)->ReleaseStringUTFChars(env, sharedCacheName, sharedCacheNameStr);
+        }
+        return -1;
+    }
 
     char error_str[256];
     size_t error_str_len = sizeof(error_str);
-    struct ub4j_context *ctx = ub4j_create_context(&ub4jconf, error_str, error_str_len);
-    long nret;
-    if (ctx == NULL) {
-        throwRuntimeException(env, error_str);
-        nret = -1;
-    } else {
-        nret = ctx->id;
+    long nret = -1;
+
+    // Each rule takes up at least 7 bytes
+    struct ub4j_prefix_rule* rules = NULL;
+    int rule_count = 0;
+    jsize packed_len = prefix_rules != NULL ? (*env)->GetArrayLength(env, prefix_rules) : 0;
+    if (packed_len > 0) {
+        size_t max_rules = (size_t)packed_len / 7;
+        rules = calloc(max_rules, sizeof(struct ub4j_prefix_rule));
+        uint8_t* packed = malloc((size_t)packed_len);
+        if (rules == NULL || packed == NULL) {
+            rule_count = -1;
+            throwOutOfMemoryError(env, "Failed to allocate memory for prefix rules.");
+        } else {
+            (*env)->GetByteArrayRegion(env, prefix_rules, 0, packed_len, (jbyte*)packed);
+            rule_count = unpack_prefix_rules(packed, (size_t)packed_len, rules, max_rules);
+            if (rule_count < 0) {
+                throwRuntimeException(env, "Malformed prefix rules.");
+            }
+        }
+        free(packed);
     }
 
+    if (rule_count >= 0) {
+        ub4jconf.prefix_rules = rules;
+        ub4jconf.prefix_rule_count = (size_t)rule_count;
+        struct ub4j_context *ctx = ub4j_create_context(&ub4jconf, error_str, error_str_len);
+        if (ctx == NULL) {
+            throwRuntimeException(env, error_str);
+        } else {
+            nret = ctx->id;
+        }
+    }
+
+    free(rules);
     if (unboundConfigStr != NULL) {
         (*env)->ReleaseStringUTFChars(env, unboundConfig, unboundConfigStr);
     }
+    if (overridesFileStr != NULL) {
+        (*env)->ReleaseStringUTFChars(env, overridesFile, overridesFileStr);
+    }
+    if (cacheSnapshotFileStr != NULL) {
+        (*env)->ReleaseStringUTFChars(env, cacheSnapshotFile, cacheSnapshotFileStr);
+    }
+    if (sharedCacheNameStr != NULL) {
+        (*env)->ReleaseStringUTFChars(env, sharedCacheName, sharedCacheNameStr);
+    }
 
     return nret;
 }
@@ -196,69 +389,300 @@ JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_delete_1context
     }
 }
 
-void callback(void* mydata, const char* err_str, char* result) {
-    struct ub4j_java_callback_context* ctx = (struct ub4j_java_callback_context*)mydata;
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_set_1overrides(JNIEnv *env, jclass clazz, jint ctx_id, jstring path) {
+    const char *pathStr = NULL;
+    if (path != NULL) {
+        pathStr = (*env)->GetStringUTFChars(env, path, NULL);
+        if (pathStr == NULL) {
+            return;
+        }
+    }
 
-    // We can't share the JNIEnv reference between threads, so we need to grab a new one here
-    JNIEnv *env;
-    int getEnvStat = (*g_vm)->GetEnv(g_vm, (void **)&env, JNI_VERSION_1_8);
+    char error_str[256];
+    size_t error_str_len = sizeof(error_str);
+    if (ub4j_set_overrides(ctx_id, pathStr, error_str, error_str_len)) {
+        throwRuntimeException(env, error_str);
+    }
+
+    if (pathStr != NULL) {
+        (*env)->ReleaseStringUTFChars(env, path, pathStr);
+    }
+}
+
+JNIEXPORT jlongArray JNICALL Java_org_opennms_unbound4j_impl_Interface_get_1stats(JNIEnv *env, jclass clazz, jint ctx_id) {
+    char error_str[256];
+    size_t error_str_len = sizeof(error_str);
+    struct ub4j_stats stats;
+    if (ub4j_get_stats(ctx_id, &stats, error_str, error_str_len)) {
+        throwRuntimeException(env, error_str);
+        return NULL;
+    }
+
+    // Keep in sync with the constructor of org.opennms.unbound4j.api.Unbound4jStats
+    jlong values[] = {
+        (jlong)stats.lookups,
+        (jlong)stats.cache_hits,
+        (jlong)stats.coalesced,
+        (jlong)stats.queries_sent,
+        (jlong)stats.rejected,
+        (jlong)stats.timeouts,
+        (jlong)stats.hostname_allocations,
+        (jlong)stats.short_circuited,
+        (jlong)stats.override_hits,
+        (jlong)stats.shared_cache_hits,
+        (jlong)stats.refreshes,
+        (jlong)stats.stale_hits,
+        (jlong)stats.not_admitted,
+        (jlong)stats.inflight_bytes,
+        (jlong)stats.cache_bytes,
+        (jlong)stats.hostname_bytes,
+        (jlong)stats.other_bytes
+    };
+    jsize len = (jsize)(sizeof(values) / sizeof(values[0]));
+    jlongArray array = (*env)->NewLongArray(env, len);
+    if (array == NULL) {
+        return NULL;
+    }
+    (*env)->SetLongArrayRegion(env, array, 0, len, values);
+    return array;
+}
+
+/**
+ * We can't share the JNIEnv reference between threads, so we need to grab a new one on every callback.
+ * Callbacks are made either on the calling Java thread, or on a processing thread which is attached
+ * when it starts, so the thread only ever needs to be attached here if that failed.
+ *
+ * @param attached set to 1 if the thread was attached by this call, and must be detached by the caller
+ * @return 0 on success, -1 otherwise
+ */
+static int get_env(JNIEnv** env, int* attached) {
+    *attached = 0;
+    int getEnvStat = (*g_vm)->GetEnv(g_vm, (void **)env, JNI_VERSION_1_8);
     if (getEnvStat == JNI_EDETACHED) {
-        if ((*g_vm)->AttachCurrentThread(g_vm, (void **)&env, NULL) != 0) {
+        if ((*g_vm)->AttachCurrentThread(g_vm, (void **)env, NULL) != 0) {
             log_fatal("unbound4j: Fatal error. Failed to attached current thread to VM.");
-            goto cleanup;
+            return -1;
         }
-    } else if (getEnvStat == JNI_OK) {
-        // all good
-    } else  {
+        *attached = 1;
+    } else if (getEnvStat != JNI_OK) {
         log_fatal("unbound4j: Fatal error. Failed to attached current thread to VM.");
-        goto cleanup;
+        return -1;
     }
+    return 0;
+}
 
-    if (err_str != NULL) {
-        completeCompletableFutureExceptionally(env, ctx->future, err_str);
-    } else if (result != NULL) {
-        jstring hostname = (*env)->NewStringUTF(env, result);
-        (*env)->CallVoidMethod(env, ctx->future, g_java_refs.completableFuture_complete, hostname);
-        jthrowable exc = (*env)->ExceptionOccurred(env);
-        if (exc) {
-            log_error("unbound4j: Error calling complete on future with host!");
-        }
-    } else {
-        (*env)->CallVoidMethod(env, ctx->future, g_java_refs.completableFuture_complete, NULL);
-        jthrowable exc = (*env)->ExceptionOccurred(env);
-        if (exc) {
-            log_error("unbound4j: Error calling complete on future.");
-        }
+void callback(void* mydata, enum ub4j_status status, const char* result) {
+    // The userdata is the id the lookup was made with
+    jlong id = (jlong)(intptr_t)mydata;
+
+    JNIEnv *env;
+    int attached;
+    if (get_env(&env, &attached)) {
+        return;
     }
 
-    (*g_vm)->DetachCurrentThread(g_vm);
-    cleanup:
-        free(ctx);
-        if (result != NULL) {
-            free(result);
-        }
+    jstring hostname = result != NULL ? (*env)->NewStringUTF(env, result) : NULL;
+    (*env)->CallStaticVoidMethod(env, g_java_refs.interface, g_java_refs.interface_complete, id, (jint)status, hostname);
+    jthrowable exc = (*env)->ExceptionOccurred(env);
+    if (exc) {
+        log_error("unbound4j: Error completing lookup %lld.", (long long)id);
+        (*env)->ExceptionClear(env);
+    }
+    if (hostname != NULL) {
+        (*env)->DeleteLocalRef(env, hostname);
+    }
+
+    if (attached) {
+        (*g_vm)->DetachCurrentThread(g_vm);
+    }
 }
 
-JNIEXPORT jobject JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup(JNIEnv *env, jclass clazz, jint ctx_id, jbyteArray addr_bytes) {
-    jobject future = (*env)->NewObject(env, g_java_refs.completableFuture, g_java_refs.completableFuture_constructor);
-    // convert the future to a global reference (otherwise the local ref will die after this method call)
-    future = (*env)->NewGlobalRef(env, future);
+void ring_callback(void* mydata, enum ub4j_status status, const char* result) {
+    // The userdata is the id the lookup was made with
+    if (ub4j_ring_put(&g_ring, (jlong)(intptr_t)mydata, status, result)) {
+        // The ring is full, fall back to completing the lookup with an upcall
+        callback(mydata, status, result);
+    }
+}
 
-    struct ub4j_java_callback_context* callback_context = malloc(sizeof(struct ub4j_java_callback_context));
-    callback_context->future = future;
+/**
+ * Throws the shared, stackless, exception for the given status.
+ */
+static void throw_lookup_failure(JNIEnv *env, enum ub4j_status status) {
+    jthrowable failure = (jthrowable)(*env)->CallStaticObjectMethod(env, g_java_refs.interface, g_java_refs.interface_failure, (jint)status);
+    if (failure != NULL) {
+        (*env)->Throw(env, failure);
+        (*env)->DeleteLocalRef(env, failure);
+    }
+}
 
-    uint8_t* addr;
-    size_t addr_len = as_uint8_array(env, addr_bytes, &addr);
+static void reverse_lookup(JNIEnv *env, jint ctx_id, jbyteArray addr_bytes, jlong id, ub4j_callback_type cb) {
+    // Copy the address onto the stack
+    uint8_t addr[16];
+    jsize addr_len = (*env)->GetArrayLength(env, addr_bytes);
+    if (addr_len > (jsize)sizeof(addr)) {
+        addr_len = 0; // rejected as an invalid length below
+    }
+    (*env)->GetByteArrayRegion(env, addr_bytes, 0, addr_len, (jbyte*)addr);
 
     char error_str[256];
     size_t error_str_len = sizeof(error_str);
+    enum ub4j_status status = ub4j_reverse_lookup(ctx_id, addr, (size_t)addr_len,
+            (void*)(intptr_t)id, cb,
+            error_str, error_str_len);
+    if (status != UB4J_STATUS_OK) {
+        throw_lookup_failure(env, status);
+    }
+}
 
-    if (ub4j_reverse_lookup(ctx_id, addr, addr_len,
-            callback_context, callback,
-            error_str, error_str_len)) {
-        throwRuntimeException(env, error_str);
+static void reverse_lookup_v4(JNIEnv *env, jint ctx_id, jint addr_int, jlong id, ub4j_callback_type cb) {
+    uint8_t addr[4];
+    for (int i = 0; i < 4; i++) {
+        addr[i] = (uint8_t)((uint32_t)addr_int >> (24 - 8 * i));
+    }
+
+    char error_str[256];
+    size_t error_str_len = sizeof(error_str);
+    enum ub4j_status status = ub4j_reverse_lookup(ctx_id, addr, sizeof(addr), (void*)(intptr_t)id, cb,
+            error_str, error_str_len);
+    if (status != UB4J_STATUS_OK) {
+        throw_lookup_failure(env, status);
+    }
+}
+
+static void reverse_lookup_v6(JNIEnv *env, jint ctx_id, jlong addr_hi, jlong addr_lo, jlong id, ub4j_callback_type cb) {
+    uint8_t addr[16];
+    for (int i = 0; i < 8; i++) {
+        addr[i] = (uint8_t)((uint64_t)addr_hi >> (56 - 8 * i));
+        addr[8 + i] = (uint8_t)((uint64_t)addr_lo >> (56 - 8 * i));
     }
 
-    free(addr);
-    return future;
+    char error_str[256];
+    size_t error_str_len = sizeof(error_str);
+    enum ub4j_status status = ub4j_reverse_lookup(ctx_id, addr, sizeof(addr), (void*)(intptr_t)id, cb,
+            error_str, error_str_len);
+    if (status != UB4J_STATUS_OK) {
+        throw_lookup_failure(env, status);
+    }
+}
+
+// Number of addresses handed to the native core at a time by reverse_lookup_batch, each takes up to 17 bytes
+#define JNI_BATCH_CHUNK_SIZE 256
+
+static void reverse_lookup_batch(JNIEnv *env, jint ctx_id, jbyteArray addr_bytes, jint count, jlong first_id, ub4j_callback_type cb) {
+    uint8_t addrs[JNI_BATCH_CHUNK_SIZE * 17];
+    void* userdata[JNI_BATCH_CHUNK_SIZE];
+    char error_str[256];
+    size_t error_str_len = sizeof(error_str);
+
+    jsize addrs_len = (*env)->GetArrayLength(env, addr_bytes);
+    jsize offset = 0;
+    jint i = 0;
+    while (i < count) {
+        // Copy the next chunk of addresses onto the stack
+        jsize chunk_len = addrs_len - offset < (jsize)sizeof(addrs) ? addrs_len - offset : (jsize)sizeof(addrs);
+        (*env)->GetByteArrayRegion(env, addr_bytes, offset, chunk_len, (jbyte*)addrs);
+
+        // Only take the addresses that were copied in whole, unless there's nothing left to copy
+        jsize used = 0;
+        int n = 0;
+        while (i + n < count && n < JNI_BATCH_CHUNK_SIZE) {
+            jsize addr_len = used < chunk_len ? addrs[used] : 0;
+            if (used + 1 + addr_len > chunk_len && offset + chunk_len < addrs_len) {
+                break;
+            }
+            used += 1 + addr_len;
+            userdata[n] = (void*)(intptr_t)(first_id + i + n);
+            n++;
+        }
+
+        enum ub4j_status status = ub4j_reverse_lookup_batch(ctx_id, addrs, (size_t)(used < chunk_len ? used : chunk_len),
+                userdata, (size_t)n, cb, error_str, error_str_len);
+        if (status != UB4J_STATUS_OK) {
+            if (i == 0) {
+                throw_lookup_failure(env, status);
+                return;
+            }
+
+            // The context went away midway, fail the rest of the lookups
+            for (; i < count; i++) {
+                cb((void*)(intptr_t)(first_id + i), status, NULL);
+            }
+            break;
+        }
+
+        i += n;
+        offset += used < chunk_len ? used : chunk_len;
+    }
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup(JNIEnv *env, jclass clazz, jint ctx_id, jbyteArray addr_bytes, jlong id) {
+    reverse_lookup(env, ctx_id, addr_bytes, id, callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1v4(JNIEnv *env, jclass clazz, jint ctx_id, jint addr, jlong id) {
+    reverse_lookup_v4(env, ctx_id, addr, id, callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1v6(JNIEnv *env, jclass clazz, jint ctx_id, jlong addr_hi, jlong addr_lo, jlong id) {
+    reverse_lookup_v6(env, ctx_id, addr_hi, addr_lo, id, callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1batch(JNIEnv *env, jclass clazz, jint ctx_id, jbyteArray addr_bytes, jint count, jlong first_id) {
+    reverse_lookup_batch(env, ctx_id, addr_bytes, count, first_id, callback);
+}
+
+JNIEXPORT jobject JNICALL Java_org_opennms_unbound4j_impl_Interface_completion_1ring(JNIEnv *env, jclass clazz, jint capacity) {
+    pthread_mutex_lock(&g_ring_lock);
+    if (!g_ring_created) {
+        if (capacity <= 0 || ub4j_ring_init(&g_ring, (size_t)capacity)) {
+            pthread_mutex_unlock(&g_ring_lock);
+            throwRuntimeException(env, "Failed to allocate the completion ring.");
+            return NULL;
+        }
+        g_ring_created = 1;
+    }
+    pthread_mutex_unlock(&g_ring_lock);
+
+    return (*env)->NewDirectByteBuffer(env, g_ring.buffer, (jlong)g_ring.capacity);
+}
+
+JNIEXPORT jlong JNICALL Java_org_opennms_unbound4j_impl_Interface_completion_1ring_1poll(JNIEnv *env, jclass clazz, jlong consumed, jint timeout_ms) {
+    if (!g_ring_created) {
+        throwRuntimeException(env, "The completion ring was not created.");
+        return -1;
+    }
+    return (jlong)ub4j_ring_poll(&g_ring, (uint64_t)consumed, timeout_ms);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1to_1ring(JNIEnv *env, jclass clazz, jint ctx_id, jbyteArray addr_bytes, jlong id) {
+    if (!g_ring_created) {
+        throwRuntimeException(env, "The completion ring was not created.");
+        return;
+    }
+    reverse_lookup(env, ctx_id, addr_bytes, id, ring_callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1v4_1to_1ring(JNIEnv *env, jclass clazz, jint ctx_id, jint addr, jlong id) {
+    if (!g_ring_created) {
+        throwRuntimeException(env, "The completion ring was not created.");
+        return;
+    }
+    reverse_lookup_v4(env, ctx_id, addr, id, ring_callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1v6_1to_1ring(JNIEnv *env, jclass clazz, jint ctx_id, jlong addr_hi, jlong addr_lo, jlong id) {
+    if (!g_ring_created) {
+        throwRuntimeException(env, "The completion ring was not created.");
+        return;
+    }
+    reverse_lookup_v6(env, ctx_id, addr_hi, addr_lo, id, ring_callback);
+}
+
+JNIEXPORT void JNICALL Java_org_opennms_unbound4j_impl_Interface_reverse_1lookup_1batch_1to_1ring(JNIEnv *env, jclass clazz, jint ctx_id, jbyteArray addr_bytes, jint count, jlong first_id) {
+    if (!g_ring_created) {
+        throwRuntimeException(env, "The completion ring was not created.");
+        return;
+    }
+    reverse_lookup_batch(env, ctx_id, addr_bytes, count, first_id, ring_callback);
 }